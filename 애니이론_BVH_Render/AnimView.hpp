@@ -33,6 +33,12 @@ struct AnimView: ModelView {
 				}
 				return true;
 			}
+			else if( JGL::_JGL::eventKey() == 'C' ) {
+				// toggles recording of the view into capture.y4m
+				captureOutput = capturedFrames<0 ? "capture.y4m" : "";
+				redraw();
+				return true;
+			}
 			else if( JGL::_JGL::eventKey() == '0' ) {
 				_animating = false;
 				_progress = 0;
@@ -52,12 +58,15 @@ struct AnimView: ModelView {
 		_animating = true;
 	}
 	float progress() const { return _progress; }
+	// Advances the animation by dt; also used with a fixed dt by runHeadless.
+	void step( float dt ) {
+		_progress += dt;
+		frameFunction(dt);
+	}
 	virtual void drawContents(NVGcontext* vg, const glm::rect&r, int a ) override {
 		if( _animating ) {
 			float t = glfwGetTime();
-			float dt = t-lastT;
-			_progress += dt;
-			frameFunction(dt);
+			step(t-lastT);
 			animate();
 			lastT = t;
 		}
@@ -0,0 +1,194 @@
+//
+//  AsyncLoader.hpp
+//  BVH_Render
+//
+//  Coroutine-based asset loading (requires C++20). A loader is written as a
+//  plain function returning AsyncLoad; inside it,
+//    co_await resumeOnWorker();  moves to the worker pool (file IO, parsing)
+//    co_await resumeOnGL();      moves back to the GL thread (uploads, swaps)
+//  The GL thread drains its queue through AsyncLoader::pumpGL(), which
+//  ModelView::drawGL calls every frame.
+//
+
+#ifndef AsyncLoader_hpp
+#define AsyncLoader_hpp
+
+#include <JGL/JGL.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerPool {
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool quit = false;
+
+	WorkerPool(int n = 0) {
+		if (n <= 0) n = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+		for (int i = 0; i < n; i++)
+			threads.emplace_back([this] { run(); });
+	}
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		cv.notify_all();
+		for (auto& t : threads) t.join();
+	}
+	void post(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		cv.notify_one();
+	}
+	void run() {
+		while (true) {
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [this] { return quit || !jobs.empty(); });
+				if (quit && jobs.empty()) return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+struct AsyncLoader {
+	// Off when there is no GLFW event loop to wake (headless runs).
+	static inline std::atomic<bool> wakeEventLoop{ true };
+	static WorkerPool& workers() {
+		static WorkerPool pool;
+		return pool;
+	}
+	static std::mutex& glMutex() {
+		static std::mutex m;
+		return m;
+	}
+	static std::vector<std::coroutine_handle<>>& glQueue() {
+		static std::vector<std::coroutine_handle<>> q;
+		return q;
+	}
+	// Number of loaders that have started but not yet finished.
+	static std::atomic<int>& inFlight() {
+		static std::atomic<int> n{ 0 };
+		return n;
+	}
+	static bool busy() {
+		return inFlight().load() > 0;
+	}
+	// Set by a loader that gives up on its asset, and when one throws, so
+	// that headless runs can fail instead of rendering without it.
+	static std::atomic<bool>& failed() {
+		static std::atomic<bool> f{ false };
+		return f;
+	}
+	static void postGL(std::coroutine_handle<> h) {
+		{
+			std::lock_guard<std::mutex> lock(glMutex());
+			glQueue().push_back(h);
+		}
+		if( wakeEventLoop )
+			glfwPostEmptyEvent();	// wake the event loop if it is waiting
+	}
+	// Resumes every loader waiting for the GL thread. Call with the context current.
+	static void pumpGL() {
+		std::vector<std::coroutine_handle<>> ready;
+		{
+			std::lock_guard<std::mutex> lock(glMutex());
+			ready.swap(glQueue());
+		}
+		for (auto h : ready) h.resume();
+	}
+	// body(chunkBegin, chunkEnd) over [begin,end), like parallelFor() but on
+	// the workers, for long jobs that must not keep the Parallel.hpp pool
+	// from the frame's loops. The caller takes chunks too, so a loader can
+	// call it from its worker even when that is the only one.
+	static void workerFor(int begin, int end, const std::function<void(int, int)>& body, int grain) {
+		struct Loop {
+			std::function<void(int, int)> body;
+			std::atomic<int> next;
+			int end, grain;
+			std::mutex mutex;
+			std::condition_variable done;
+			int running = 0;			// helpers inside work()
+			void work() {
+				for (;;) {
+					int i = next.fetch_add(grain);
+					if (i >= end) break;
+					body(i, std::min(i + grain, end));
+				}
+			}
+		};
+		if (end <= begin) return;
+		auto loop = std::make_shared<Loop>();
+		loop->body = body;
+		loop->next = begin;
+		loop->end = end;
+		loop->grain = std::max(1, grain);
+		// a helper that starts after the last chunk was taken finds nothing to do
+		for (size_t i = 0; i < workers().threads.size(); i++)
+			workers().post([loop] {
+				{
+					std::lock_guard<std::mutex> lock(loop->mutex);
+					loop->running++;
+				}
+				loop->work();
+				std::lock_guard<std::mutex> lock(loop->mutex);
+				if (--loop->running == 0) loop->done.notify_all();
+			});
+		loop->work();
+		std::unique_lock<std::mutex> lock(loop->mutex);
+		loop->done.wait(lock, [&] { return loop->running == 0; });
+	}
+};
+
+// Fire-and-forget coroutine: starts running immediately on the calling thread.
+struct AsyncLoad {
+	struct promise_type {
+		promise_type() { AsyncLoader::inFlight()++; }
+		~promise_type() { AsyncLoader::inFlight()--; }
+		AsyncLoad get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() {
+			AsyncLoader::failed() = true;
+			try { throw; }
+			catch (const std::exception& e) { std::cerr << "[ERROR] Async load: " << e.what() << std::endl; }
+			catch (...) { std::cerr << "[ERROR] Async load failed" << std::endl; }
+		}
+	};
+};
+
+struct ResumeOnWorker {
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) const { AsyncLoader::workers().post([h] { h.resume(); }); }
+	void await_resume() const noexcept {}
+};
+
+struct ResumeOnGL {
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) const { AsyncLoader::postGL(h); }
+	void await_resume() const noexcept {}
+};
+
+inline ResumeOnWorker resumeOnWorker() { return {}; }
+inline ResumeOnGL resumeOnGL() { return {}; }
+
+#endif /* AsyncLoader_hpp */
@@ -0,0 +1,231 @@
+//
+//  FrameCapture.hpp
+//  BVH_Render
+//
+//  Framebuffer readback that does not stall the GL pipeline. capture() only
+//  queues glReadPixels into one of RING pixel-buffer objects and fences it;
+//  the slot is mapped when the ring comes back around to it, normally a
+//  couple of frames later when the copy has long finished. Flipping, format
+//  conversion and encoding run on a dedicated writer thread.
+//
+
+#ifndef FrameCapture_hpp
+#define FrameCapture_hpp
+
+#include "GLTools.hpp"
+#include "AsyncLoader.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// Writes top-down RGB8 frames as a Y4M 4:2:0 stream (BT.601, limited range)
+// or as one binary PPM per frame.
+struct FrameSink {
+	FILE* file = nullptr;
+	bool y4m = false;
+	std::string pattern;
+	int w = 0, h = 0;
+	std::vector<uint8_t> yuv;
+
+	bool open( const std::string& out, int ww, int hh, float fps ) {
+		w = ww; h = hh;
+		y4m = out == "-" || ( out.size()>=4 && out.compare( out.size()-4, 4, ".y4m" )==0 );
+		if( !y4m ) {
+			pattern = out;
+			return true;
+		}
+		file = out == "-" ? streamStdout() : fopen( out.c_str(), "wb" );
+		if( !file ) {
+			std::cerr<<"[ERROR] Frame capture: "<<out<<" could not be opened\n";
+			return false;
+		}
+		fprintf( file, "YUV4MPEG2 W%d H%d F%d:1000 Ip A1:1 C420jpeg\n", w, h, (int)(fps*1000+.5f) );
+		return true;
+	}
+	bool write( const uint8_t* rgb, int frame ) {
+		if( !y4m ) {
+			char fn[1024];
+			snprintf( fn, sizeof(fn), pattern.c_str(), frame );
+			FILE* f = fopen( fn, "wb" );
+			if( !f ) {
+				std::cerr<<"[ERROR] Frame capture: "<<fn<<" could not be opened\n";
+				return false;
+			}
+			fprintf( f, "P6\n%d %d\n255\n", w, h );
+			fwrite( rgb, 1, (size_t)w*h*3, f );
+			fclose( f );
+			return true;
+		}
+		int cw = (w+1)/2, ch = (h+1)/2;
+		yuv.resize( (size_t)w*h + (size_t)cw*ch*2 );
+		uint8_t* Y = yuv.data();
+		uint8_t* U = Y + (size_t)w*h;
+		uint8_t* V = U + (size_t)cw*ch;
+		for( int i=0; i<w*h; i++ ) {
+			int r = rgb[i*3], g = rgb[i*3+1], b = rgb[i*3+2];
+			Y[i] = (uint8_t)(((66*r + 129*g + 25*b + 128)>>8) + 16);
+		}
+		for( int y=0; y<ch; y++ ) for( int x=0; x<cw; x++ ) {
+			int r = 0, g = 0, b = 0, n = 0;
+			for( int dy=0; dy<2 && y*2+dy<h; dy++ ) for( int dx=0; dx<2 && x*2+dx<w; dx++ ) {
+				const uint8_t* p = rgb + ((size_t)(y*2+dy)*w + x*2+dx)*3;
+				r += p[0]; g += p[1]; b += p[2]; n++;
+			}
+			r /= n; g /= n; b /= n;
+			U[y*cw+x] = (uint8_t)(((-38*r - 74*g + 112*b + 128)>>8) + 128);
+			V[y*cw+x] = (uint8_t)(((112*r - 94*g - 18*b + 128)>>8) + 128);
+		}
+		fputs( "FRAME\n", file );
+		return fwrite( yuv.data(), 1, yuv.size(), file ) == yuv.size();
+	}
+	void close() {
+		if( file && file != streamStdout() ) fclose( file );
+		else if( file ) fflush( file );
+		file = nullptr;
+	}
+	// The real stdout, for streaming to a pipe. The viewers log to stdout, so
+	// the first call points fd 1 at stderr to keep that out of the stream;
+	// call it before anything is printed.
+	static FILE* streamStdout() {
+#ifdef WIN32
+		return stdout;
+#else
+		static FILE* f = []() {
+			fflush( stdout );
+			FILE* s = fdopen( dup( 1 ), "wb" );
+			dup2( 2, 1 );
+			return s;
+		}();
+		return f;
+#endif
+	}
+};
+
+struct FrameCapture {
+	static const int RING = 3;			// frames in flight on the GPU side
+	static const int MAX_QUEUED = 8;	// frames waiting for the writer before capture() blocks
+
+	struct Slot {
+		GLuint pbo = 0;
+		GLsync fence = 0;
+		int frame = -1;
+	};
+	Slot slots[RING];
+	int head = 0;
+	int w = 0, h = 0;
+	// Called on the writer thread, in frame order, with top-down RGB8 pixels.
+	std::function<bool(const uint8_t* rgb, int frame)> writer;
+	std::atomic<bool> failed{ false };
+
+	std::unique_ptr<WorkerPool> thread;	// one thread, so frames are written in order
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<std::vector<uint8_t>> freeBuffers;
+	std::vector<uint8_t> rgb;			// writer thread scratch
+	int queued = 0;
+
+	void create( int ww, int hh, std::function<bool(const uint8_t*, int)> write ) {
+		clearGL();
+		w = ww; h = hh;
+		writer = std::move( write );
+		failed = false;
+		if( !thread ) thread = std::make_unique<WorkerPool>( 1 );
+		for( auto& s: slots ) {
+			glGenBuffers( 1, &s.pbo );
+			glBindBuffer( GL_PIXEL_PACK_BUFFER, s.pbo );
+			glBufferData( GL_PIXEL_PACK_BUFFER, (size_t)w*h*4, nullptr, GL_STREAM_READ );
+		}
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	}
+	// Queues a read of the w x h region at (x,y) of fbo. The slot being reused
+	// is retired first; with RING frames of latency that rarely waits.
+	void capture( GLuint fbo, int x, int y, int frame ) {
+		Slot& s = slots[head];
+		if( s.fence ) retire( s );
+		GLint oldRead;
+		glGetIntegerv( GL_READ_FRAMEBUFFER_BINDING, &oldRead );
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, fbo );
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, s.pbo );
+		glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+		glReadPixels( x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr );
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+		glBindFramebuffer( GL_READ_FRAMEBUFFER, oldRead );
+		s.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		s.frame = frame;
+		head = (head+1)%RING;
+	}
+	// Retires every outstanding slot and waits until the writer is idle.
+	void finish() {
+		for( int i=0; i<RING; i++ ) {
+			Slot& s = slots[(head+i)%RING];
+			if( s.fence ) retire( s );
+		}
+		std::unique_lock<std::mutex> lock( mutex );
+		cv.wait( lock, [this] { return queued==0; } );
+	}
+	void clearGL() {
+		if( thread ) finish();
+		for( auto& s: slots ) {
+			if( s.fence ) glDeleteSync( s.fence );
+			if( s.pbo ) glDeleteBuffers( 1, &s.pbo );
+			s = Slot();
+		}
+		head = 0;
+	}
+	~FrameCapture() {
+		thread.reset();		// joins after the queued frames are written
+	}
+
+private:
+	void retire( Slot& s ) {
+		glClientWaitSync( s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+		glDeleteSync( s.fence );
+		s.fence = 0;
+		std::vector<uint8_t> buf;
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			cv.wait( lock, [this] { return queued<MAX_QUEUED; } );
+			queued++;
+			if( !freeBuffers.empty() ) {
+				buf = std::move( freeBuffers.back() );
+				freeBuffers.pop_back();
+			}
+		}
+		buf.resize( (size_t)w*h*4 );
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, s.pbo );
+		const void* p = glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, buf.size(), GL_MAP_READ_BIT );
+		if( p ) memcpy( buf.data(), p, buf.size() );
+		glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+		int frame = s.frame;
+		auto job = std::make_shared<std::vector<uint8_t>>( std::move( buf ) );
+		thread->post( [this, job, frame] {
+			// bottom-up RGBA -> top-down RGB
+			rgb.resize( (size_t)w*h*3 );
+			for( int y=0; y<h; y++ ) {
+				const uint8_t* src = job->data() + (size_t)(h-1-y)*w*4;
+				uint8_t* dst = rgb.data() + (size_t)y*w*3;
+				for( int x=0; x<w; x++, src+=4, dst+=3 ) {
+					dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2];
+				}
+			}
+			if( !failed && writer && !writer( rgb.data(), frame ) ) failed = true;
+			std::lock_guard<std::mutex> lock( mutex );
+			freeBuffers.push_back( std::move( *job ) );
+			queued--;
+			cv.notify_all();
+		} );
+	}
+};
+
+#endif /* FrameCapture_hpp */
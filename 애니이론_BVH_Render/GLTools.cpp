@@ -6,14 +6,26 @@
 //
 
 #include "GLTools.hpp"
+#include "Parallel.hpp"
 #include <vector>
+#include <algorithm>
 #include <tuple>
+#include <regex>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+struct InstanceData {
+	glm::mat4 modelMat;
+	glm::vec4 color;
+};
 
 struct RenderableMesh {
 	GLuint va=0;
 	GLuint vBuf=0;
 	GLuint nBuf=0;
 	GLuint eBuf=0;
+	GLuint iBuf=0;
 	unsigned int nFaces=0;
 	void create( const std::vector<glm::vec3>& vertices,
 				const std::vector<glm::vec3>& normals,
@@ -49,10 +61,48 @@ struct RenderableMesh {
 		glBindVertexArray( 0 );
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0 );
 	}
+	// One draw with an instanced program, reading the constant attribute values.
+	void renderConstant() {
+		glBindVertexArray( va );
+		if( iBuf )
+			for( int i=2; i<=6; i++ ) glDisableVertexAttribArray( i );
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eBuf );
+		glDrawElements(GL_TRIANGLES, nFaces, GL_UNSIGNED_INT, 0);
+		if( iBuf )
+			for( int i=2; i<=6; i++ ) glEnableVertexAttribArray( i );
+		glBindVertexArray( 0 );
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0 );
+	}
+	// Per-instance modelMat (attributes 2-5) and color (6), see buildInstancedProgram.
+	void renderInstanced( const std::vector<InstanceData>& instances ) {
+		if( instances.empty() ) return;
+		glBindVertexArray( va );
+		if( !iBuf ) {
+			glGenBuffers(1, &iBuf);
+			glBindBuffer(GL_ARRAY_BUFFER, iBuf);
+			for( int i=0; i<4; i++ ) {
+				glEnableVertexAttribArray( 2+i );
+				glVertexAttribPointer(2+i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(sizeof(glm::vec4)*i));
+				glVertexAttribDivisor( 2+i, 1 );
+			}
+			glEnableVertexAttribArray( 6 );
+			glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, color));
+			glVertexAttribDivisor( 6, 1 );
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, iBuf);
+		// orphan the old storage so the driver does not wait for the previous draw
+		glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData)*instances.size(), nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(InstanceData)*instances.size(), instances.data());
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eBuf );
+		glDrawElementsInstanced(GL_TRIANGLES, nFaces, GL_UNSIGNED_INT, 0, (GLsizei)instances.size());
+		glBindVertexArray( 0 );
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0 );
+		glBindBuffer(GL_ARRAY_BUFFER, 0 );
+	}
 };
 
 
-void drawQuad() {
+static RenderableMesh& quadMesh() {
 	static RenderableMesh mesh;
 	if( !mesh.va ) {
 		const std::vector<glm::vec3> v = { {-1,1,0}, {-1,-1,0}, {1,1,0}, {1,-1,0} };
@@ -61,110 +111,896 @@ void drawQuad() {
 		const std::vector<glm::uvec3> e = { {0,1,2}, {2,1,3} };
 		mesh.create( v, n, e );
 	}
-	mesh.render();
+	return mesh;
+}
+
+static void drawRaw( RenderableMesh& mesh );
+
+void drawQuad() {
+	drawRaw( quadMesh() );
 }
 
 const int N_STRIP = 15;
 const int N_SLICE = 30;
 const float PI = 3.1415926535;
-void drawSphere() {
-	static RenderableMesh mesh;
+// Tessellation per level of detail, finest first.
+struct LodLevel {
+	int strip, slice;
+};
+constexpr LodLevel SPHERE_LODS[LOD_COUNT] = { {N_STRIP,N_SLICE}, {10,20}, {6,12}, {4,8} };
+constexpr int CYLINDER_LODS[LOD_COUNT] = { N_SLICE, 16, 10, 6 };
+// Smallest projected radius, in pixels, at which each level is still used.
+constexpr float LOD_MIN_PIXELS[LOD_COUNT] = { 40, 15, 5, 0 };
+static RenderableMesh& sphereMesh( int lod = 0 ) {
+	static RenderableMesh meshes[LOD_COUNT];
+	RenderableMesh& mesh = meshes[lod];
 	if( !mesh.va ) {
+		const int nStrip = SPHERE_LODS[lod].strip, nSlice = SPHERE_LODS[lod].slice;
 		std::vector<glm::vec3> v;
 		std::vector<glm::uvec3> e;
 		
 		v.push_back({0,1,0});
-		for( int s = 1; s<N_STRIP; s++ ) {
-			float y = cosf( s*PI/N_STRIP );
-			float r = sinf( s*PI/N_STRIP );
-			for( int l=0; l<N_SLICE; l++ )
-				v.push_back({sinf(l*PI*2/N_SLICE)*r,y,cosf(l*PI*2/N_SLICE)*r});
+		for( int s = 1; s<nStrip; s++ ) {
+			float y = cosf( s*PI/nStrip );
+			float r = sinf( s*PI/nStrip );
+			for( int l=0; l<nSlice; l++ )
+				v.push_back({sinf(l*PI*2/nSlice)*r,y,cosf(l*PI*2/nSlice)*r});
 		}
 		v.push_back({0,-1,0});
 		{
 			int s1 = 1;
-			for( int l=0; l<N_SLICE; l++ )
-				e.push_back({0,l+s1,((l+1)%N_SLICE)+s1});
-		}
-		for( int s = 1; s<N_STRIP; s++ ) {
-			int s0 = (s-1)*N_SLICE+1;
-			int s1 = s*N_SLICE+1;
-			for( int l=0; l<N_SLICE; l++ ) {
-				e.push_back({l+s0,l+s1,((l+1)%N_SLICE)+s0});
-				e.push_back({((l+1)%N_SLICE)+s0,l+s1,((l+1)%N_SLICE)+s1});
+			for( int l=0; l<nSlice; l++ )
+				e.push_back({0,l+s1,((l+1)%nSlice)+s1});
+		}
+		for( int s = 1; s<nStrip; s++ ) {
+			int s0 = (s-1)*nSlice+1;
+			int s1 = s*nSlice+1;
+			for( int l=0; l<nSlice; l++ ) {
+				e.push_back({l+s0,l+s1,((l+1)%nSlice)+s0});
+				e.push_back({((l+1)%nSlice)+s0,l+s1,((l+1)%nSlice)+s1});
 			}
 		}
 		{
-			int s0 = (N_STRIP-2)*N_SLICE+1;
-			int s1 = (N_STRIP-1)*N_SLICE+1;
-			for( int l=0; l<N_SLICE; l++ ) 
-				e.push_back({s1,((l+1)%N_SLICE)+s0,l+s0});
+			int s0 = (nStrip-2)*nSlice+1;
+			int s1 = (nStrip-1)*nSlice+1;
+			for( int l=0; l<nSlice; l++ ) 
+				e.push_back({s1,((l+1)%nSlice)+s0,l+s0});
 		}
 		mesh.create( v, v, e );
 	}
-	mesh.render();
+	return mesh;
 }
 
+void drawSphere() {
+	drawRaw( sphereMesh() );
+}
 
-void drawCylinder() {
-	static RenderableMesh mesh;
+
+static RenderableMesh& cylinderMesh( int lod = 0 ) {
+	static RenderableMesh meshes[LOD_COUNT];
+	RenderableMesh& mesh = meshes[lod];
 	if( !mesh.va ) {
+		const int nSlice = CYLINDER_LODS[lod];
 		std::vector<glm::vec3> v;
 		std::vector<glm::vec3> n;
 		std::vector<glm::uvec3> e;
 		
 		v.push_back({0,.5,0});
 		n.push_back({0,1,0});
-		for( int l=0; l<N_SLICE; l++ ) {
-			v.push_back({sinf(l*PI*2/N_SLICE),.5,cosf(l*PI*2/N_SLICE)});
+		for( int l=0; l<nSlice; l++ ) {
+			v.push_back({sinf(l*PI*2/nSlice),.5,cosf(l*PI*2/nSlice)});
 			n.push_back({0,1,0});
 		}
-		for( int l=0; l<N_SLICE; l++ ) {
-			glm::vec2 p = {sinf(l*PI*2/N_SLICE),cosf(l*PI*2/N_SLICE)}; 
+		for( int l=0; l<nSlice; l++ ) {
+			glm::vec2 p = {sinf(l*PI*2/nSlice),cosf(l*PI*2/nSlice)}; 
 			v.push_back({p.x,.5,p.y});
 			n.push_back({p.x,0,p.y});
 		}
-		for( int l=0; l<N_SLICE; l++ ) {
-			glm::vec2 p = {sinf(l*PI*2/N_SLICE),cosf(l*PI*2/N_SLICE)}; 
+		for( int l=0; l<nSlice; l++ ) {
+			glm::vec2 p = {sinf(l*PI*2/nSlice),cosf(l*PI*2/nSlice)}; 
 			v.push_back({p.x,-.5,p.y});
 			n.push_back({p.x,0,p.y});
 		}
-		for( int l=0; l<N_SLICE; l++ ) {
-			v.push_back({sinf(l*PI*2/N_SLICE),-.5,cosf(l*PI*2/N_SLICE)});
+		for( int l=0; l<nSlice; l++ ) {
+			v.push_back({sinf(l*PI*2/nSlice),-.5,cosf(l*PI*2/nSlice)});
 			n.push_back({0,-1,0});
 		}
 		v.push_back({0,-.5,0});
 		n.push_back({0,-1,0});
 		{
 			int s1 = 1;
-			for( int l=0; l<N_SLICE; l++ )
-				e.push_back({0,l+s1,((l+1)%N_SLICE)+s1});
+			for( int l=0; l<nSlice; l++ )
+				e.push_back({0,l+s1,((l+1)%nSlice)+s1});
 		}
 		{
-			int s0 = N_SLICE+1;
-			int s1 = N_SLICE*2+1;
-			for( int l=0; l<N_SLICE; l++ ) {
-				e.push_back({l+s0,l+s1,((l+1)%N_SLICE)+s0});
-				e.push_back({((l+1)%N_SLICE)+s0,l+s1,((l+1)%N_SLICE)+s1});
+			int s0 = nSlice+1;
+			int s1 = nSlice*2+1;
+			for( int l=0; l<nSlice; l++ ) {
+				e.push_back({l+s0,l+s1,((l+1)%nSlice)+s0});
+				e.push_back({((l+1)%nSlice)+s0,l+s1,((l+1)%nSlice)+s1});
 			}
 		}
 		{
-			int s0 = N_SLICE*3+1;
-			int s1 = N_SLICE*4+1;
-			for( int l=0; l<N_SLICE; l++ ) 
-				e.push_back({s1,((l+1)%N_SLICE)+s0,l+s0});
+			int s0 = nSlice*3+1;
+			int s1 = nSlice*4+1;
+			for( int l=0; l<nSlice; l++ ) 
+				e.push_back({s1,((l+1)%nSlice)+s0,l+s0});
 		}
 		mesh.create( v, n, e );
 	}
+	return mesh;
+}
+
+void drawCylinder() {
+	drawRaw( cylinderMesh() );
+}
+
+static RenderableMesh& meshOf( int mesh, int lod ) {
+	switch( mesh ) {
+		case MESH_QUAD:		return quadMesh();
+		case MESH_SPHERE:	return sphereMesh( lod );
+		default:			return cylinderMesh( lod );
+	}
+}
+
+static glm::mat4 lodViewMat;
+static float lodPixelScale = 0;		// 0: always the finest level
+
+void setLodView( const glm::mat4& viewMat, const glm::mat4& projMat, float viewportHeight ) {
+	lodViewMat = viewMat;
+	lodPixelScale = projMat[1][1]*viewportHeight/2;
+}
+void clearLodView() {
+	lodPixelScale = 0;
+}
+
+// Level for a unit sphere/cylinder mesh placed by modelMat, from the radius
+// it projects to at its center (the cylinder's radius is its x scale).
+static int selectLod( int mesh, const glm::mat4& modelMat ) {
+	if( mesh == MESH_QUAD || lodPixelScale <= 0 ) return 0;
+	float r = length( glm::vec3( modelMat[0] ) );
+	if( mesh == MESH_SPHERE )
+		r = std::max( r, std::max( length( glm::vec3( modelMat[1] ) ), length( glm::vec3( modelMat[2] ) ) ) );
+	float z = -( lodViewMat*modelMat[3] ).z;
+	if( z <= r ) return 0;
+	float pixels = r*lodPixelScale/z;
+	int lod = 0;
+	while( lod < LOD_COUNT-1 && pixels < LOD_MIN_PIXELS[lod] ) lod++;
+	return lod;
+}
+
+static bool instancing = false;
+static std::vector<InstanceData> instances[MESH_COUNT][LOD_COUNT];
+static GLuint impostorProgram = 0;
+static std::vector<InstanceData> impostorInstances[2];		// spheres, cylinders
+static glm::vec3 impostorEye, impostorForward;
+static float impostorNear = 0;
+static DrawList* recording = nullptr;
+static bool staticDraws = false;
+
+void beginInstancing() {
+	instancing = true;
+}
+void setImpostorProgram( GLuint prog, const glm::mat4& viewMat, const glm::mat4& projMat ) {
+	glm::mat4 camera = inverse( viewMat );
+	impostorProgram = prog;
+	impostorEye = glm::vec3( camera[3] );
+	impostorForward = -glm::vec3( camera[2] );
+	impostorNear = projMat[3][2]/( projMat[2][2]-1 );
+}
+void clearImpostorProgram() {
+	impostorProgram = 0;
+}
+
+// Whether the quad the impostor vertex shader builds for a unit sphere
+// (axisScale 0) or cylinder (1) placed by m reaches the near plane, where
+// it would be clipped whole. Its corners lie within `extent` of its center.
+static bool impostorClipsNear( const glm::mat4& m, float axisScale ) {
+	glm::vec3 c = glm::vec3( m[3] ), axis = glm::vec3( m[1] )*axisScale;
+	float r = length( glm::vec3( m[0] ) ), h = length( axis )*.5f;
+	glm::vec3 v = c-impostorEye;
+	float dist = length( v );
+	if( dist <= r+h ) return true;
+	v /= dist;
+	float uv = h>0 ? dot( axis, v )/( 2*h ) : 0;
+	float lu = h>0 ? sqrtf( std::max( 0.f, 1-uv*uv ) ) : 0;
+	float dPlane = dist-r-h*fabsf( uv );
+	float extent = sqrtf( ( h*lu+r )*( h*lu+r )+r*r );
+	return dPlane*dot( v, impostorForward )-extent < impostorNear*1.001f;
+}
+
+void flushInstances() {
+	if( impostorProgram ) {
+		// spheres and cylinders become impostors unless too close to the eye
+		for( int i : { MESH_SPHERE, MESH_CYLINDER } )
+			for( int l=0; l<LOD_COUNT; l++ ) {
+				std::vector<InstanceData>& list = instances[i][l];
+				size_t meshes = 0;
+				for( auto& d: list ) {
+					if( impostorClipsNear( d.modelMat, i == MESH_CYLINDER ) ) list[meshes++] = d;
+					else impostorInstances[i == MESH_CYLINDER].push_back( d );
+				}
+				list.resize( meshes );
+			}
+	}
+	for( int i=0; i<MESH_COUNT; i++ )
+		for( int l=0; l<LOD_COUNT; l++ ) {
+			meshOf( i, l ).renderInstanced( instances[i][l] );
+			instances[i][l].clear();
+		}
+	if( impostorProgram ) {
+		static const UniformId U_AXIS_SCALE = uniformId( "imp_axisScale" );
+		GLuint prog = currentProgram();
+		useProgram( impostorProgram );
+		for( int k=0; k<2; k++ ) {
+			setUniform( impostorProgram, U_AXIS_SCALE, (float)k );
+			quadMesh().renderInstanced( impostorInstances[k] );
+			impostorInstances[k].clear();
+		}
+		useProgram( prog );
+	}
+}
+void endInstancing() {
+	flushInstances();
+	instancing = false;
+}
+
+static std::vector<GLuint> instancedPrograms;
+static bool isInstancedProgram( GLuint prog ) {
+	return std::find( instancedPrograms.begin(), instancedPrograms.end(), prog ) != instancedPrograms.end();
+}
+static void setInstanceAttributes( const glm::mat4& modelMat, const glm::vec4& color ) {
+	for( int i=0; i<4; i++ )
+		glVertexAttrib4fv( 2+i, glm::value_ptr( modelMat[i] ) );
+	glVertexAttrib4fv( 6, glm::value_ptr( color ) );
+}
+void instanceUniform( GLuint prog, UniformId u, const glm::mat4& v ) {
+	static const UniformId U_MODELMAT = uniformId( "modelMat" );
+	if( u.id != U_MODELMAT.id || !isInstancedProgram( prog ) ) return;
+	for( int i=0; i<4; i++ )
+		glVertexAttrib4fv( 2+i, glm::value_ptr( v[i] ) );
+}
+void instanceUniform( GLuint prog, UniformId u, const glm::vec4& v ) {
+	static const UniformId U_COLOR = uniformId( "color" );
+	if( u.id != U_COLOR.id || !isInstancedProgram( prog ) ) return;
+	glVertexAttrib4fv( 6, glm::value_ptr( v ) );
+}
+
+// A mesh drawn by the caller with its own modelMat/color uniforms.
+static void drawRaw( RenderableMesh& mesh ) {
+	if( !instancing ) {
+		mesh.render();
+		return;
+	}
+	flushInstances();
+	mesh.renderConstant();
+}
+
+void beginRecording( DrawList& list ) {
+	recording = &list;
+}
+void endRecording() {
+	recording = nullptr;
+}
+void beginStatic() {
+	staticDraws = true;
+}
+void endStatic() {
+	staticDraws = false;
+}
+
+static bool culling = false;
+static glm::vec4 cullPlanes[6];
+static CullStats cullCounters;
+
+// Planes of the clip volume -w<=x,y,z<=w of viewProj, normals pointing in.
+void setCullFrustum( const glm::mat4& viewProj ) {
+	glm::vec4 row[4];
+	for( int i=0; i<4; i++ )
+		row[i] = glm::vec4( viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i] );
+	for( int i=0; i<3; i++ ) {
+		cullPlanes[i*2]   = row[3]+row[i];
+		cullPlanes[i*2+1] = row[3]-row[i];
+	}
+	for( auto& p: cullPlanes )
+		p /= length( glm::vec3( p ) );
+	culling = true;
+}
+void clearCullFrustum() {
+	culling = false;
+}
+CullStats cullStats() {
+	return cullCounters;
+}
+void resetCullStats() {
+	cullCounters = CullStats();
+}
+
+// Bounding sphere of a unit mesh placed by modelMat (quad: +-1 in xy,
+// sphere: radius 1, cylinder: radius 1 and height 1, all centered).
+static float boundingRadius( int mesh, const glm::mat4& m ) {
+	static const float UNIT_RADIUS[MESH_COUNT] = { 1.4142136f, 1.f, 1.1180340f };
+	float s = std::max( dot( glm::vec3( m[0] ), glm::vec3( m[0] ) ),
+			  std::max( dot( glm::vec3( m[1] ), glm::vec3( m[1] ) ), dot( glm::vec3( m[2] ), glm::vec3( m[2] ) ) ) );
+	return UNIT_RADIUS[mesh]*sqrtf( s );
+}
+static bool insideFrustum( const glm::vec3& center, float r ) {
+	glm::vec4 c = glm::vec4( center, 1 );
+	for( auto& p: cullPlanes )
+		if( dot( p, c ) < -r ) return false;
+	return true;
+}
+static bool insideFrustum( int mesh, const glm::mat4& modelMat ) {
+	return insideFrustum( glm::vec3( modelMat[3] ), boundingRadius( mesh, modelMat ) );
+}
+
+// Tests a whole command list at once: bounding spheres go into SoA arrays
+// and each plane is one branch-free loop over them, which the compiler
+// vectorizes.
+static std::vector<float> cullX, cullY, cullZ, cullR;
+static std::vector<uint8_t> cullVisible;
+static const uint8_t* cullBatch( const std::vector<DrawCommand>& commands ) {
+	size_t n = commands.size();
+	cullX.resize( n ); cullY.resize( n ); cullZ.resize( n ); cullR.resize( n );
+	cullVisible.assign( n, 1 );
+	for( size_t i=0; i<n; i++ ) {
+		if( const DynamicMesh* d = commands[i].dynamic ) {
+			cullX[i] = d->center.x; cullY[i] = d->center.y; cullZ[i] = d->center.z;
+			cullR[i] = d->radius;
+			continue;
+		}
+		const glm::mat4& m = commands[i].modelMat;
+		cullX[i] = m[3].x; cullY[i] = m[3].y; cullZ[i] = m[3].z;
+		cullR[i] = boundingRadius( commands[i].mesh, m );
+	}
+	const float* x = cullX.data(); const float* y = cullY.data();
+	const float* z = cullZ.data(); const float* r = cullR.data();
+	uint8_t* visible = cullVisible.data();
+	for( auto& p: cullPlanes ) {
+		const float a = p.x, b = p.y, c = p.z, d = p.w;
+		for( size_t i=0; i<n; i++ )
+			visible[i] &= (uint8_t)( a*x[i]+b*y[i]+c*z[i]+d >= -r[i] );
+	}
+	int nVisible = 0;
+	for( size_t i=0; i<n; i++ ) nVisible += visible[i];
+	cullCounters.submitted += nVisible;
+	cullCounters.culled += (int)n-nVisible;
+	return visible;
+}
+
+// Dynamic meshes hold world-space vertices and are drawn right away, also
+// while instancing: instanced programs then read modelMat/color from
+// attributes 2-6, which take their constant values as the mesh's vertex
+// array does not enable them.
+static void emitDynamic( DynamicMesh& mesh, const glm::vec4& color ) {
+	static const UniformId U_MODELMAT = uniformId( "modelMat" ), U_COLOR = uniformId( "color" );
+	if( instancing && color.w < 1 ) flushInstances();
+	GLuint prog = currentProgram();
+	setUniform(prog, U_MODELMAT, glm::mat4(1) );
+	setUniform(prog, U_COLOR, color );
 	mesh.render();
 }
 
-static inline GLuint getCurProgram() {
-	GLint prog;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+static void emit( int mesh, const glm::mat4& modelMat, const glm::vec4& color, DynamicMesh* dynamic = nullptr ) {
+	if( dynamic ) {
+		emitDynamic( *dynamic, color );
+		return;
+	}
+	if( instancing && color.w < 1 ) {
+		flushInstances();
+		setInstanceAttributes( modelMat, color );
+		meshOf( mesh, selectLod( mesh, modelMat ) ).renderConstant();
+		return;
+	}
+	if( instancing ) {
+		instances[mesh][selectLod( mesh, modelMat )].push_back( { modelMat, color } );
+		return;
+	}
+	static const UniformId U_MODELMAT = uniformId( "modelMat" ), U_COLOR = uniformId( "color" );
+	GLuint prog = currentProgram();
+	setUniform(prog, U_MODELMAT, modelMat );
+	setUniform(prog, U_COLOR, color );
+	meshOf( mesh, selectLod( mesh, modelMat ) ).render();
+}
+
+// Common tail of the draw helpers: record, or cull and then batch or draw.
+static void submit( int mesh, const glm::mat4& modelMat, const glm::vec4& color, DynamicMesh* dynamic = nullptr ) {
+	if( recording ) {
+		(staticDraws ? recording->staticCommands : recording->commands).push_back( { mesh, modelMat, color, dynamic } );
+		return;
+	}
+	if( culling ) {
+		bool inside = dynamic ? insideFrustum( dynamic->center, dynamic->radius ) : insideFrustum( mesh, modelMat );
+		(inside ? cullCounters.submitted : cullCounters.culled)++;
+		if( !inside ) return;
+	}
+	emit( mesh, modelMat, color, dynamic );
+}
+
+static void replayCommands( const std::vector<DrawCommand>& commands ) {
+	if( !culling ) {
+		for( auto& c: commands )
+			emit( c.mesh, c.modelMat, c.color, c.dynamic );
+		return;
+	}
+	const uint8_t* visible = cullBatch( commands );
+	for( size_t i=0; i<commands.size(); i++ )
+		if( visible[i] ) emit( commands[i].mesh, commands[i].modelMat, commands[i].color, commands[i].dynamic );
+}
+void replay( const std::vector<DrawCommand>& commands, bool instanced ) {
+	if( instanced ) beginInstancing();
+	replayCommands( commands );
+	if( instanced ) endInstancing();
+}
+void replay( const DrawList& list, bool instanced ) {
+	if( instanced ) beginInstancing();
+	replayCommands( list.staticCommands );
+	replayCommands( list.commands );
+	if( instanced ) endInstancing();
+}
+
+// Rewrites a shader written for the immediate path (uniform modelMat/color)
+// into one that takes them per instance. Returns "" if the shader does not
+// follow that layout, in which case the caller keeps drawing immediately.
+std::string makeInstancedShader( const std::string& code, GLuint SHADER_TYPE ) {
+	std::smatch m;
+	if( !std::regex_search( code, m, std::regex("#version\\s+(\\d+)") ) || std::stoi( m[1] ) < 130 )
+		return "";
+	const std::regex modelMatDecl("uniform\\s+mat4\\s+modelMat\\s*;");
+	const std::regex colorDecl("uniform\\s+vec4\\s+color\\s*;");
+	const std::regex mainDecl("void\\s+main\\s*\\(\\s*(void)?\\s*\\)\\s*\\{");
+	std::string out = code;
+	if( SHADER_TYPE == GL_VERTEX_SHADER ) {
+		if( !std::regex_search( out, modelMatDecl ) || !std::regex_search( out, mainDecl ) )
+			return "";
+		out = std::regex_replace( out, modelMatDecl,
+			"in mat4 i_modelMat;\nin vec4 i_color;\nflat out vec4 v_instColor;\n#define modelMat i_modelMat" );
+		out = std::regex_replace( out, colorDecl, "\n#define color i_color" );
+		out = std::regex_replace( out, mainDecl, "$&\n\tv_instColor = i_color;",
+			std::regex_constants::format_first_only );
+	}
+	else
+		out = std::regex_replace( out, colorDecl, "flat in vec4 v_instColor;\n#define color v_instColor" );
+	return out;
+}
+
+GLuint buildInstancedProgram( const std::string& vertCode, const std::string& fragCode ) {
+	std::string vc = makeInstancedShader( vertCode, GL_VERTEX_SHADER );
+	std::string fc = makeInstancedShader( fragCode, GL_FRAGMENT_SHADER );
+	if( vc.empty() || fc.empty() ) return 0;
+	GLuint vert = compileShader( vc, GL_VERTEX_SHADER );
+	GLuint frag = compileShader( fc, GL_FRAGMENT_SHADER );
+	GLuint prog = glCreateProgram();
+	glAttachShader( prog, vert );
+	glAttachShader( prog, frag );
+	glBindAttribLocation( prog, 2, "i_modelMat" );
+	glBindAttribLocation( prog, 6, "i_color" );
+	glLinkProgram( prog );
+	glDeleteShader( vert );
+	glDeleteShader( frag );
+	GLint ok = 0;
+	glGetProgramiv( prog, GL_LINK_STATUS, &ok );
+	if( !ok ) {
+		printInfoProgramLog( prog );
+		deleteProgram( prog );
+		return 0;
+	}
+	reflectProgram( prog );
+	instancedPrograms.push_back( prog );
+	return prog;
+}
+
+// Impostors: a sphere or cylinder is one camera-facing quad whose fragments
+// ray-cast the exact surface and write its depth. The programs are written
+// here rather than derived from shader.vert/shader.frag: the unshaded one
+// outputs `color` like const.frag, the shaded one lights with Lambert from
+// lightPos under the shadow map plus the irradiance of iblCoeffs (order L00,
+// L1-1, L10, L11, L2-2, L2-1, L20, L21, L22), which approximates but need
+// not match a custom shader.frag.
+
+static const char* IMPOSTOR_VERT = R"(#version 410 core
+layout(std140) uniform FrameConstants {
+	mat4 viewMat;
+	mat4 projMat;
+	vec3 lightPos;
+};
+layout(location=0) in vec3 imp_corner;
+layout(location=2) in mat4 i_modelMat;
+layout(location=6) in vec4 i_color;
+uniform float imp_axisScale;
+out vec3 imp_p;
+flat out vec3 imp_a;
+flat out vec3 imp_b;
+flat out float imp_r;
+flat out vec3 imp_eye;
+flat out vec4 imp_color;
+void main() {
+	vec3 c = i_modelMat[3].xyz;
+	vec3 axis = i_modelMat[1].xyz*imp_axisScale;
+	float r = length( i_modelMat[0].xyz );
+	vec3 eye = inverse( viewMat )[3].xyz;
+	vec3 v = c-eye;
+	float dist = length( v );
+	v /= dist;
+	float h = length( axis )*0.5;
+	vec3 u = h>0.0 ? axis/( 2.0*h ) : vec3( 0 );
+	// Quad perpendicular to the view ray, in front of the whole shape; the
+	// extents bound its orthographic footprint, which bounds the perspective
+	// one. Shapes for which this quad reaches the near plane are drawn as
+	// meshes instead (see impostorClipsNear).
+	vec3 side = u-v*dot( u, v );
+	float lu = length( side );
+	if( lu>1e-4 ) side /= lu;
+	else side = normalize( cross( v, abs( v.y )<0.99 ? vec3( 0, 1, 0 ) : vec3( 1, 0, 0 ) ) );
+	vec3 up = cross( side, v );
+	float dPlane = dist-r-h*abs( dot( u, v ) );
+	vec3 p = eye+v*dPlane+side*( imp_corner.y*( h*lu+r ) )+up*( imp_corner.x*r );
+	imp_p = p;
+	imp_a = c-axis*0.5;
+	imp_b = c+axis*0.5;
+	imp_r = r;
+	imp_eye = eye;
+	imp_color = i_color;
+	gl_Position = projMat*viewMat*vec4( p, 1 );
+}
+)";
+
+static const char* IMPOSTOR_FRAG_HEAD = R"(#version 410 core
+layout(std140) uniform FrameConstants {
+	mat4 viewMat;
+	mat4 projMat;
+	vec3 lightPos;
+};
+in vec3 imp_p;
+flat in vec3 imp_a;
+flat in vec3 imp_b;
+flat in float imp_r;
+flat in vec3 imp_eye;
+flat in vec4 imp_color;
+out vec4 outColor;
+
+// Distance along rd to the sphere (a == b) or the capped cylinder a-b, -1 on a miss.
+float imp_intersect( vec3 ro, vec3 rd, out vec3 n ) {
+	vec3 ba = imp_b-imp_a;
+	vec3 oa = ro-imp_a;
+	float baba = dot( ba, ba );
+	if( baba<1e-12 ) {
+		float b = dot( oa, rd ), c = dot( oa, oa )-imp_r*imp_r, h = b*b-c;
+		if( h<0.0 ) return -1.0;
+		float t = -b-sqrt( h );
+		n = ( oa+t*rd )/imp_r;
+		return t;
+	}
+	float bard = dot( ba, rd ), baoa = dot( ba, oa );
+	float k2 = baba-bard*bard;
+	float k1 = baba*dot( oa, rd )-baoa*bard;
+	float k0 = baba*dot( oa, oa )-baoa*baoa-imp_r*imp_r*baba;
+	float h = k1*k1-k2*k0;
+	if( h<0.0 ) return -1.0;
+	h = sqrt( h );
+	float t = ( -k1-h )/k2;
+	float y = baoa+t*bard;
+	if( y>0.0 && y<baba ) {
+		n = ( oa+t*rd-ba*y/baba )/imp_r;
+		return t;
+	}
+	// the cap facing the ray
+	t = ( ( y<0.0 ? 0.0 : baba )-baoa )/bard;
+	if( abs( k1+k2*t )<h ) {
+		n = ba*sign( y )/sqrt( baba );
+		return t;
+	}
+	return -1.0;
+}
+)";
+
+static const char* IMPOSTOR_FRAG_UNSHADED = R"(
+void main() {
+	vec3 rd = normalize( imp_p-imp_eye ), n;
+	float t = imp_intersect( imp_eye, rd, n );
+	if( t<0.0 ) discard;
+	vec4 clip = projMat*viewMat*vec4( imp_eye+rd*t, 1.0 );
+	gl_FragDepth = ( gl_DepthRange.diff*clip.z/clip.w+gl_DepthRange.near+gl_DepthRange.far )*0.5;
+	outColor = imp_color;
+}
+)";
+
+static const char* IMPOSTOR_FRAG_SHADED = R"(
+uniform vec3 iblCoeffs[9];
+uniform int shadowEnabled;
+uniform sampler2D shadowMap;
+uniform mat4 shadowBiasedVP;
+vec3 irradiance( vec3 n ) {
+	const float c1 = 0.429043, c2 = 0.511664, c3 = 0.743125, c4 = 0.886227, c5 = 0.247708;
+	return c1*iblCoeffs[8]*( n.x*n.x-n.y*n.y )+c3*iblCoeffs[6]*n.z*n.z+c4*iblCoeffs[0]-c5*iblCoeffs[6]
+		+2.0*c1*( iblCoeffs[4]*n.x*n.y+iblCoeffs[7]*n.x*n.z+iblCoeffs[5]*n.y*n.z )
+		+2.0*c2*( iblCoeffs[3]*n.x+iblCoeffs[1]*n.y+iblCoeffs[2]*n.z );
+}
+void main() {
+	vec3 rd = normalize( imp_p-imp_eye ), n;
+	float t = imp_intersect( imp_eye, rd, n );
+	if( t<0.0 ) discard;
+	vec3 pos = imp_eye+rd*t;
+	vec4 clip = projMat*viewMat*vec4( pos, 1.0 );
+	gl_FragDepth = ( gl_DepthRange.diff*clip.z/clip.w+gl_DepthRange.near+gl_DepthRange.far )*0.5;
+	float visible = 1.0;
+	if( shadowEnabled==1 ) {
+		vec4 sp = shadowBiasedVP*vec4( pos, 1.0 );
+		sp /= sp.w;
+		if( texture( shadowMap, sp.xy ).r<sp.z-0.0005 ) visible = 0.0;
+	}
+	float diffuse = max( dot( n, normalize( lightPos-pos ) ), 0.0 )*visible;
+	vec3 ambient = max( irradiance( n ), vec3( 0 ) )/3.1415926;
+	outColor = vec4( imp_color.rgb*( 0.7*diffuse+0.3*ambient ), imp_color.a );
+}
+)";
+
+GLuint buildImpostorProgram( bool shaded ) {
+	GLuint vert = compileShader( IMPOSTOR_VERT, GL_VERTEX_SHADER );
+	GLuint frag = compileShader( std::string( IMPOSTOR_FRAG_HEAD )+( shaded ? IMPOSTOR_FRAG_SHADED : IMPOSTOR_FRAG_UNSHADED ), GL_FRAGMENT_SHADER );
+	GLuint prog = glCreateProgram();
+	glAttachShader( prog, vert );
+	glAttachShader( prog, frag );
+	glLinkProgram( prog );
+	glDeleteShader( vert );
+	glDeleteShader( frag );
+	GLint ok = 0;
+	glGetProgramiv( prog, GL_LINK_STATUS, &ok );
+	if( !ok ) {
+		printInfoProgramLog( prog );
+		deleteProgram( prog );
+		return 0;
+	}
+	reflectProgram( prog );
 	return prog;
 }
 
+static std::unordered_map<std::string,int> uniformIds;
+static std::vector<std::string> uniformNames;
+static std::unordered_map<GLuint,std::vector<GLint>> uniformLocations;
+static const GLint UNRESOLVED = -2;
+static GLuint curProgram = 0;
+
+UniformId uniformId( const std::string& name ) {
+	auto it = uniformIds.find( name );
+	if( it != uniformIds.end() ) return { it->second };
+	int id = (int)uniformNames.size();
+	uniformIds.emplace( name, id );
+	uniformNames.push_back( name );
+	return { id };
+}
+
+GLint uniformLocation( GLuint prog, UniformId u ) {
+	std::vector<GLint>& locs = uniformLocations[prog];
+	if( u.id >= (int)locs.size() ) locs.resize( uniformNames.size(), UNRESOLVED );
+	if( locs[u.id] == UNRESOLVED )		// program was not reflected, or name interned later
+		locs[u.id] = glGetUniformLocation( prog, uniformNames[u.id].c_str() );
+	return locs[u.id];
+}
+GLint uniformLocation( GLuint prog, const std::string& name ) {
+	return uniformLocation( prog, uniformId( name ) );
+}
+
+// Resolves every active uniform once after linking; names the program does
+// not use resolve to -1 so setUniform can skip them without a GL call.
+void reflectProgram( GLuint prog ) {
+	GLint n = 0, maxLen = 0;
+	glGetProgramiv( prog, GL_ACTIVE_UNIFORMS, &n );
+	glGetProgramiv( prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLen );
+	std::vector<char> buf( maxLen+1 );
+	std::vector<std::pair<int,GLint>> found;
+	for( GLint i=0; i<n; i++ ) {
+		GLint size; GLenum type; GLsizei len = 0;
+		glGetActiveUniform( prog, i, (GLsizei)buf.size(), &len, &size, &type, buf.data() );
+		std::string name( buf.data(), len );
+		if( name.size()>3 && name.compare( name.size()-3, 3, "[0]" )==0 )
+			name.resize( name.size()-3 );
+		GLint loc = glGetUniformLocation( prog, name.c_str() );
+		if( loc >= 0 ) found.push_back( { uniformId( name ).id, loc } );
+	}
+	std::vector<GLint>& locs = uniformLocations[prog];
+	locs.assign( uniformNames.size(), -1 );
+	for( auto& f: found ) locs[f.first] = f.second;
+	GLuint block = glGetUniformBlockIndex( prog, "FrameConstants" );
+	if( block != GL_INVALID_INDEX )
+		glUniformBlockBinding( prog, block, FRAME_CONSTANTS_BINDING );
+}
+
+void deleteProgram( GLuint prog ) {
+	if( !prog ) return;
+	uniformLocations.erase( prog );
+	instancedPrograms.erase( std::remove( instancedPrograms.begin(), instancedPrograms.end(), prog ), instancedPrograms.end() );
+	if( impostorProgram == prog ) impostorProgram = 0;
+	if( curProgram == prog ) curProgram = 0;
+	glDeleteProgram( prog );
+}
+
+void useProgram( GLuint prog ) {
+	glUseProgram( prog );
+	curProgram = prog;
+}
+GLuint currentProgram() {
+	return curProgram;
+}
+
+// Moves `uniform mat4 viewMat;`, `uniform mat4 projMat;` and
+// `uniform vec3 lightPos;` into the std140 FrameConstants block (layout as in
+// struct FrameConstants). Shaders declaring those names any other way are
+// returned unchanged and keep using plain uniforms.
+std::string useFrameConstants( const std::string& code ) {
+	std::smatch m;
+	if( !std::regex_search( code, m, std::regex("#version\\s+(\\d+)") ) || std::stoi( m[1] ) < 140 )
+		return code;
+	const char* names[] = { "viewMat", "projMat", "lightPos" };
+	const char* types[] = { "mat4", "mat4", "vec3" };
+	std::string out = code;
+	size_t first = std::string::npos;
+	for( int i=0; i<3; i++ ) {
+		std::regex any( std::string("uniform\\s+\\w+\\s+")+names[i]+"\\b" );
+		std::regex exact( std::string("uniform\\s+")+types[i]+"\\s+"+names[i]+"\\s*;" );
+		int nAny = (int)std::distance( std::sregex_iterator( out.begin(), out.end(), any ), std::sregex_iterator() );
+		if( nAny == 0 ) continue;
+		if( !std::regex_search( out, m, exact ) || nAny > 1 ) return code;
+		first = std::min<size_t>( first, m.position(0) );
+		out = std::regex_replace( out, exact, "" );
+	}
+	if( first == std::string::npos ) return code;
+	out.insert( first, "layout(std140) uniform FrameConstants {\n\tmat4 viewMat;\n\tmat4 projMat;\n\tvec3 lightPos;\n};\n" );
+	return out;
+}
+
+struct DynamicVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+static bool hasBufferStorage() {
+#ifdef GL_MAP_PERSISTENT_BIT
+	static int has = -1;
+	if( has < 0 ) {
+		GLint major = 0, minor = 0;
+		glGetIntegerv( GL_MAJOR_VERSION, &major );
+		glGetIntegerv( GL_MINOR_VERSION, &minor );
+		has = major > 4 || ( major == 4 && minor >= 4 );
+	}
+	return has;
+#else
+	return false;
+#endif
+}
+
+void DynamicMesh::setFaces( const std::vector<glm::uvec3>& f, int n ) {
+	clearGL();
+	faces = f;
+	nVertices = n;
+	faceNormals.resize( faces.size() );
+	vertexFaceStart.assign( n+1, 0 );
+	for( auto& t: faces )
+		for( int k=0; k<3; k++ ) vertexFaceStart[t[k]+1]++;
+	for( int v=0; v<n; v++ )
+		vertexFaceStart[v+1] += vertexFaceStart[v];
+	vertexFaces.resize( vertexFaceStart[n] );
+	std::vector<int> fill( vertexFaceStart.begin(), vertexFaceStart.end()-1 );
+	for( int i=0; i<(int)faces.size(); i++ )
+		for( int k=0; k<3; k++ ) vertexFaces[fill[faces[i][k]]++] = i;
+}
+
+void DynamicMesh::update( const glm::vec3* positions, size_t stride ) {
+	fill( [=]( int i ) -> const glm::vec3& {
+		return *(const glm::vec3*)( (const unsigned char*)positions + stride*i );
+	} );
+}
+void DynamicMesh::update( const float* x, const float* y, const float* z ) {
+	fill( [=]( int i ) { return glm::vec3( x[i], y[i], z[i] ); } );
+}
+
+template<typename Position>
+void DynamicMesh::fill( const Position& P ) {
+	if( nVertices == 0 ) return;
+	size_t bytes = sizeof(DynamicVertex)*nVertices;
+	if( !va ) {
+		glGenVertexArrays(1, &va);
+		glBindVertexArray( va );
+		glGenBuffers(1, &vBuf);
+		glBindBuffer(GL_ARRAY_BUFFER, vBuf);
+#ifdef GL_MAP_PERSISTENT_BIT
+		if( hasBufferStorage() ) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT|GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_ARRAY_BUFFER, bytes*RING, nullptr, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes*RING, flags);
+		}
+		else
+#endif
+			glBufferData(GL_ARRAY_BUFFER, bytes*RING, nullptr, GL_STREAM_DRAW);
+		glEnableVertexAttribArray( 0 );
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(DynamicVertex), (void*)offsetof(DynamicVertex, position));
+		glEnableVertexAttribArray( 1 );
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, sizeof(DynamicVertex), (void*)offsetof(DynamicVertex, normal));
+		glGenBuffers(1, &eBuf);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eBuf);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(glm::uvec3)*faces.size(), faces.data(), GL_STATIC_DRAW);
+		glBindVertexArray( 0 );
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	// Every draw from the current region has been issued by now; fence it
+	// and move on to the oldest one.
+	if( region >= 0 )
+		fences[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	region = (region+1)%RING;
+	if( fences[region] ) {
+		glClientWaitSync( fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull );
+		glDeleteSync( fences[region] );
+		fences[region] = 0;
+	}
+	DynamicVertex* dst;
+	if( mapped )
+		dst = (DynamicVertex*)( mapped + bytes*region );
+	else {
+		glBindBuffer(GL_ARRAY_BUFFER, vBuf);
+		dst = (DynamicVertex*)glMapBufferRange(GL_ARRAY_BUFFER, bytes*region, bytes,
+				GL_MAP_WRITE_BIT|GL_MAP_INVALIDATE_RANGE_BIT|GL_MAP_UNSYNCHRONIZED_BIT);
+		if( !dst ) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+	}
+	// Area-weighted face normals, then each vertex gathers its own faces, so
+	// neither loop writes to shared data.
+	parallelFor( 0, (int)faces.size(), [&]( int b, int e ) {
+		for( int i=b; i<e; i++ ) {
+			const glm::uvec3& t = faces[i];
+			faceNormals[i] = cross( P(t[1])-P(t[0]), P(t[2])-P(t[0]) );
+		}
+	} );
+	parallelFor( 0, nVertices, [&]( int b, int e ) {
+		for( int v=b; v<e; v++ ) {
+			glm::vec3 n( 0 );
+			for( int k=vertexFaceStart[v]; k<vertexFaceStart[v+1]; k++ )
+				n += faceNormals[vertexFaces[k]];
+			float l = length( n );
+			dst[v] = { P(v), l>0 ? n/l : glm::vec3(0,1,0) };
+		}
+	} );
+	if( !mapped ) {
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glm::vec3 lo = P(0), hi = lo;
+	for( int v=1; v<nVertices; v++ ) {
+		lo = min( lo, P(v) );
+		hi = max( hi, P(v) );
+	}
+	center = (lo+hi)/2.f;
+	radius = length( hi-lo )/2;
+}
+
+void DynamicMesh::render() {
+	if( region < 0 ) return;
+	glBindVertexArray( va );
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eBuf );
+	glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)faces.size()*3, GL_UNSIGNED_INT, 0, nVertices*region);
+	glBindVertexArray( 0 );
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0 );
+}
+
+void DynamicMesh::clearGL() {
+	for( auto& f: fences ) {
+		if( f ) glDeleteSync( f );
+		f = 0;
+	}
+	if( vBuf ) glDeleteBuffers(1, &vBuf);	// also unmaps
+	if( eBuf ) glDeleteBuffers(1, &eBuf);
+	if( va ) glDeleteVertexArrays(1, &va);
+	va = vBuf = eBuf = 0;
+	mapped = nullptr;
+	region = -1;
+}
+
+void drawMesh( DynamicMesh& mesh, const glm::vec4 color ) {
+	submit( MESH_DYNAMIC, glm::mat4(1), color, &mesh );
+}
+
 void drawQuad( const glm::vec3& p, const glm::vec3& n, const glm::vec2& sz, const glm::vec4 color, const glm::mat4& mat ) {
 	glm::vec3 s = {sz.x,sz.y,1};
 	glm::vec3 axis = cross(n,glm::vec3(0,0,1));
@@ -175,18 +1011,12 @@ void drawQuad( const glm::vec3& p, const glm::vec3& n, const glm::vec2& sz, cons
 		modelMat = mat * glm::translate(p)*glm::rotate( angle, axis )*glm::scale(s);
 	else
 		modelMat = mat * glm::translate(p)*glm::scale(s);
-	GLuint prog = getCurProgram();
-	setUniform(prog, "modelMat", modelMat );
-	setUniform(prog, "color", color );
-	drawQuad();
+	submit( MESH_QUAD, modelMat, color );
 }
 	
 void drawSphere( const glm::vec3& p, float r, const glm::vec4 color, const glm::mat4& mat ){
 	glm::mat4 modelMat = mat * glm::translate(p)*glm::scale(glm::vec3(r));
-	GLuint prog = getCurProgram();
-	setUniform(prog, "modelMat", modelMat );
-	setUniform(prog, "color", color );
-	drawSphere();
+	submit( MESH_SPHERE, modelMat, color );
 }
 void drawCylinder( const glm::vec3& p1, const glm::vec3& p2, float r, const glm::vec4 color, const glm::mat4& mat ) {
 	glm::vec3 s = {r,length(p1-p2),r};
@@ -198,9 +1028,6 @@ void drawCylinder( const glm::vec3& p1, const glm::vec3& p2, float r, const glm:
 		modelMat = mat * glm::translate((p1+p2)/2.f)*glm::rotate( angle, axis )*glm::scale(s);
 	else
 		modelMat = mat * glm::translate((p1+p2)/2.f)*glm::scale(s);
-	GLuint prog = getCurProgram();
-	setUniform(prog, "modelMat", modelMat );
-	setUniform(prog, "color", color );
-	drawCylinder();
+	submit( MESH_CYLINDER, modelMat, color );
 }
 
@@ -13,6 +13,7 @@
 #include <JGL/JGL_Widget.hpp>
 #include <fstream>
 #include <tuple>
+#include <vector>
 
 #ifdef WIN32
 typedef wchar_t CHAR_T;
@@ -31,6 +32,24 @@ typedef char CHAR_T;
 #define utf82Unicode(X) (X)
 #endif
 
+// Uniform names are interned once into small integer ids; every program keeps
+// a table of locations indexed by id, filled by reflectProgram() at link time.
+struct UniformId {
+	int id;
+};
+extern UniformId uniformId( const std::string& name );
+extern GLint uniformLocation( GLuint prog, UniformId u );
+extern GLint uniformLocation( GLuint prog, const std::string& name );
+extern void reflectProgram( GLuint prog );
+// glDeleteProgram that also drops the program's locations, so a program
+// created later with the same id does not inherit them.
+extern void deleteProgram( GLuint prog );
+
+// glUseProgram with the current program tracked on the CPU, so draws do not
+// have to query GL_CURRENT_PROGRAM.
+extern void useProgram( GLuint prog );
+extern GLuint currentProgram();
+
 static inline void printInfoProgramLog(GLuint obj ) {
 	int infologLength = 0, charsWritten  = 0;
 	glGetProgramiv( obj, GL_INFO_LOG_LENGTH, &infologLength );
@@ -63,8 +82,7 @@ static inline std::string readText( const std::string& fn ) {
 	return str;
 }
 
-static inline GLuint loadShader( const std::string& fn, GLuint SHADER_TYPE ) {
-	std::string code = readText( fn );
+static inline GLuint compileShader( const std::string& code, GLuint SHADER_TYPE ) {
 	GLuint shader = glCreateShader(SHADER_TYPE);
 	
 	const GLchar* vshaderCode = code.c_str();
@@ -74,14 +92,18 @@ static inline GLuint loadShader( const std::string& fn, GLuint SHADER_TYPE ) {
 	
 	return shader;
 }
+static inline GLuint loadShader( const std::string& fn, GLuint SHADER_TYPE ) {
+	return compileShader( readText( fn ), SHADER_TYPE );
+}
 static inline GLuint buildProgram(GLuint vertShader, GLuint fragShader ) {
 	GLuint prog = glCreateProgram();
 	glAttachShader  ( prog, vertShader );
 	glAttachShader  ( prog, fragShader );
 	
 	glLinkProgram( prog );
-	glUseProgram ( prog );
 	printInfoProgramLog( prog );
+	reflectProgram( prog );
+	useProgram( prog );
 	
 	return prog;
 }
@@ -94,44 +116,180 @@ static inline std::tuple<GLuint,GLuint,GLuint> loadProgram( const std::string& v
 }
 
 
-static inline void setUniform( GLuint prog, const std::string& name, const int& v ) {
-	glUniform1i(glGetUniformLocation( prog, name.c_str() ), v);
+static inline void uniformAt( GLint loc, const int& v ) {
+	glUniform1i(loc, v);
 }
-static inline void setUniform( GLuint prog, const std::string& name, const float& v ) {
-	glUniform1f(glGetUniformLocation( prog, name.c_str() ), v);
+static inline void uniformAt( GLint loc, const float& v ) {
+	glUniform1f(loc, v);
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::ivec2& v ) {
-	glUniform2iv(glGetUniformLocation( prog, name.c_str() ), 1, glm::value_ptr(v));
+static inline void uniformAt( GLint loc, const glm::ivec2& v ) {
+	glUniform2iv(loc, 1, glm::value_ptr(v));
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::ivec3& v ) {
-	glUniform3iv(glGetUniformLocation( prog, name.c_str() ), 1, glm::value_ptr(v));
+static inline void uniformAt( GLint loc, const glm::ivec3& v ) {
+	glUniform3iv(loc, 1, glm::value_ptr(v));
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::vec2& v ) {
-	glUniform2fv(glGetUniformLocation( prog, name.c_str() ), 1, glm::value_ptr(v));
+static inline void uniformAt( GLint loc, const glm::vec2& v ) {
+	glUniform2fv(loc, 1, glm::value_ptr(v));
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::vec3& v ) {
-	glUniform3fv(glGetUniformLocation( prog, name.c_str() ), 1, glm::value_ptr(v));
+static inline void uniformAt( GLint loc, const glm::vec3& v ) {
+	glUniform3fv(loc, 1, glm::value_ptr(v));
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::vec4& v ) {
-	glUniform4fv(glGetUniformLocation( prog, name.c_str() ), 1, glm::value_ptr(v));
+static inline void uniformAt( GLint loc, const glm::vec4& v ) {
+	glUniform4fv(loc, 1, glm::value_ptr(v));
+}
+static inline void uniformAt( GLint loc, const glm::mat3& v ) {
+	glUniformMatrix3fv(loc, 1, 0, glm::value_ptr(v));
+}
+static inline void uniformAt( GLint loc, const glm::mat4& v ) {
+	glUniformMatrix4fv(loc, 1, 0, glm::value_ptr(v));
+}
+
+// Programs from buildInstancedProgram() read modelMat and color per instance;
+// setting those uniforms on them sets the constant vertex attributes that raw
+// drawQuad()/drawSphere()/drawCylinder() calls read instead.
+template<typename T>
+static inline void instanceUniform( GLuint prog, UniformId u, const T& v ) {}
+extern void instanceUniform( GLuint prog, UniformId u, const glm::mat4& v );
+extern void instanceUniform( GLuint prog, UniformId u, const glm::vec4& v );
+
+template<typename T>
+static inline void setUniform( GLuint prog, UniformId u, const T& v ) {
+	GLint loc = uniformLocation( prog, u );
+	if( loc >= 0 ) uniformAt( loc, v );
+	else instanceUniform( prog, u, v );
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::mat3& v ) {
-	glUniformMatrix3fv(glGetUniformLocation( prog, name.c_str()), 1, 0, glm::value_ptr(v));
+template<typename T>
+static inline void setUniform( GLuint prog, const std::string& name, const T& v ) {
+	setUniform( prog, uniformId( name ), v );
 }
-static inline void setUniform( GLuint prog, const std::string& name, const glm::mat4& v ) {
-	glUniformMatrix4fv(glGetUniformLocation( prog, name.c_str()), 1, 0, glm::value_ptr(v));
+static inline void setUniform( GLuint prog, UniformId u, const glm::vec3* v, int n ) {
+	GLint loc = uniformLocation( prog, u );
+	if( loc >= 0 ) glUniform3fv(loc, n, (GLfloat*)v);
 }
 static inline void setUniform( GLuint prog, const std::string& name, const glm::vec3* v, int n ) {
-	glUniform3fv(glGetUniformLocation( prog, name.c_str() ), n, (GLfloat*)v);
+	setUniform( prog, uniformId( name ), v, n );
 }
 
-
+// Per-frame constants shared by every program through one uniform buffer.
+// Shaders opt in through useFrameConstants(), which moves their viewMat,
+// projMat and lightPos uniforms into the FrameConstants block.
+struct FrameConstants {
+	glm::mat4 viewMat;
+	glm::mat4 projMat;
+	glm::vec4 lightPos;
+};
+const GLuint FRAME_CONSTANTS_BINDING = 0;
+extern std::string useFrameConstants( const std::string& code );
 
 extern void drawQuad();
 extern void drawSphere();
 extern void drawCylinder();
 
+// Between beginInstancing() and endInstancing() the drawQuad/drawSphere/drawCylinder
+// calls below only record an instance; endInstancing() (or flushInstances())
+// issues one instanced draw per mesh with the program that is current then,
+// which must come from buildInstancedProgram(). Batched primitives are thus
+// drawn grouped by mesh after the draws that follow them, which the depth
+// test hides for opaque ones. Translucent primitives (alpha below 1), raw
+// draws and translucent meshes flush the batch first and are drawn in place,
+// so blending keeps the order of the calls.
+extern void beginInstancing();
+extern void flushInstances();
+extern void endInstancing();
+extern std::string makeInstancedShader( const std::string& code, GLuint SHADER_TYPE );
+extern GLuint buildInstancedProgram( const std::string& vertCode, const std::string& fragCode );
+
+// With an impostor program set, instanced spheres and cylinders are drawn as
+// ray-cast quads with that program instead of meshes, except those whose quad
+// would reach the near plane of projMat, seen from viewMat. shaded picks the
+// lit program for the main pass over the flat one for shadow passes; either
+// reads the uniforms ModelView sets, FrameConstants for the view.
+extern GLuint buildImpostorProgram( bool shaded );
+extern void setImpostorProgram( GLuint prog, const glm::mat4& viewMat, const glm::mat4& projMat );
+extern void clearImpostorProgram();
+
+// Between beginRecording() and endRecording() the same calls only append a
+// command to the list; replay() submits the list again with the program that
+// is current then, so one recording can feed several passes.
+// Draws issued between beginStatic() and endStatic() while recording go to
+// staticCommands, which the shadow pass caches across frames.
+// A DynamicMesh is drawn as MESH_DYNAMIC, which is never instanced.
+enum { MESH_QUAD, MESH_SPHERE, MESH_CYLINDER, MESH_COUNT, MESH_DYNAMIC = MESH_COUNT };
+struct DynamicMesh;
+struct DrawCommand {
+	int mesh;
+	glm::mat4 modelMat;
+	glm::vec4 color;
+	DynamicMesh* dynamic = nullptr;
+	bool operator==( const DrawCommand& o ) const {
+		// a dynamic mesh may have moved without the command changing
+		return mesh==o.mesh && modelMat==o.modelMat && color==o.color && !dynamic && !o.dynamic;
+	}
+};
+struct DrawList {
+	std::vector<DrawCommand> commands;
+	std::vector<DrawCommand> staticCommands;
+	void clear() { commands.clear(); staticCommands.clear(); }
+	size_t size() const { return commands.size()+staticCommands.size(); }
+};
+// Spheres and cylinders come in LOD_COUNT tessellations; each draw picks one
+// from its projected radius under the view given to setLodView()
+// (viewportHeight in pixels). Without a view the finest mesh is used.
+const int LOD_COUNT = 4;
+extern void setLodView( const glm::mat4& viewMat, const glm::mat4& projMat, float viewportHeight );
+extern void clearLodView();
+
+// Frustum culling: after setCullFrustum() draws whose bounding sphere lies
+// outside the frustum of viewProj are dropped (replay() tests the whole list
+// in one batch). Counters accumulate until resetCullStats().
+struct CullStats {
+	int submitted = 0;
+	int culled = 0;
+};
+extern void setCullFrustum( const glm::mat4& viewProj );
+extern void clearCullFrustum();
+extern CullStats cullStats();
+extern void resetCullStats();
+
+extern void beginRecording( DrawList& list );
+extern void endRecording();
+extern void beginStatic();
+extern void endStatic();
+extern void replay( const std::vector<DrawCommand>& commands, bool instanced );
+extern void replay( const DrawList& list, bool instanced );
+
+// A triangle mesh whose vertices move every frame, such as cloth. The faces
+// are given once; update() recomputes smooth vertex normals in parallel and
+// streams positions and normals into the next of RING regions of a single
+// vertex buffer, persistently mapped where GL 4.4 is available. A region is
+// only rewritten after the fence of the frame that last drew from it has
+// signaled, so the CPU never waits on the GPU in the common case. Call
+// update() on the GL thread once per frame, then drawMesh() in every pass.
+struct DynamicMesh {
+	static const int RING = 3;
+	std::vector<glm::uvec3> faces;
+	std::vector<int> vertexFaceStart, vertexFaces;	// faces around each vertex (CSR)
+	std::vector<glm::vec3> faceNormals;
+	int nVertices = 0;
+	glm::vec3 center = glm::vec3(0);				// bounding sphere of the last update
+	float radius = 0;
+
+	GLuint va=0, vBuf=0, eBuf=0;
+	GLsync fences[RING] = {};
+	unsigned char* mapped = nullptr;			// persistent mapping, or null
+	int region = -1;							// written by the last update()
+
+	void setFaces( const std::vector<glm::uvec3>& faces, int nVertices );
+	// positions: nVertices points `stride` bytes apart, or separate x/y/z arrays
+	void update( const glm::vec3* positions, size_t stride = sizeof(glm::vec3) );
+	void update( const float* x, const float* y, const float* z );
+	void render();
+	void clearGL();
+private:
+	template<typename Position> void fill( const Position& P );
+};
 
+extern void drawMesh( DynamicMesh& mesh, const glm::vec4 color = glm::vec4(1,.4,0,1) );
 extern void drawQuad( const glm::vec3& p, const glm::vec3& n, const glm::vec2& sz, const glm::vec4 color = glm::vec4(0,0,.4,1), const glm::mat4& mat=glm::mat4(1) );
 extern void drawSphere( const glm::vec3& p, float r, const glm::vec4 color = glm::vec4(1,.4,0,1), const glm::mat4& mat=glm::mat4(1) );
 extern void drawCylinder( const glm::vec3& p1, const glm::vec3& p2, float r, const glm::vec4 color = glm::vec4(1,0,0,1), const glm::mat4& mat=glm::mat4(1) );
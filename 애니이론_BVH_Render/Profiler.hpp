@@ -0,0 +1,147 @@
+//
+//  Profiler.hpp
+//  BVH_Render
+//
+//  Scoped stage timers recorded into per-thread ring buffers and dumped as
+//  Chrome trace JSON (load the file in chrome://tracing or ui.perfetto.dev).
+//
+//  Timers are compiled in only when ENABLE_PROFILER is defined; otherwise
+//  PROFILE_SCOPE expands to nothing. When compiled in, Profiler::enabled can
+//  still switch recording off at runtime for the cost of one relaxed load.
+//
+
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+	const char* name;	// must be a string literal (or otherwise outlive the trace)
+	uint64_t begin;		// ns since Profiler::epoch()
+	uint64_t dur;		// ns
+};
+
+// Single-producer ring: only the owning thread writes, readers take a snapshot
+// of `head`. Oldest events are overwritten once the ring is full. Clearing
+// only bumps `clears`; each owner empties its own ring on its next push, and
+// readers skip rings that have not caught up yet.
+struct TraceRing {
+	static const size_t CAPACITY = 1 << 16;
+	static inline std::atomic<uint64_t> clears{ 0 };
+	std::vector<TraceEvent> events = std::vector<TraceEvent>(CAPACITY);
+	std::atomic<uint64_t> head{ 0 };
+	std::atomic<uint64_t> cleared{ 0 };	// value of `clears` when the ring was last emptied
+	int tid = 0;
+
+	void push(const TraceEvent& e) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		uint64_t c = clears.load(std::memory_order_relaxed);
+		if (c != cleared.load(std::memory_order_relaxed)) {
+			h = 0;
+			cleared.store(c, std::memory_order_relaxed);
+		}
+		events[h & (CAPACITY - 1)] = e;
+		head.store(h + 1, std::memory_order_release);
+	}
+	bool stale() const {
+		return cleared.load(std::memory_order_acquire) != clears.load(std::memory_order_acquire);
+	}
+};
+
+struct Profiler {
+	static inline std::atomic<bool> enabled{ true };
+
+	static std::chrono::steady_clock::time_point epoch() {
+		static const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		return t0;
+	}
+	static uint64_t now() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch()).count();
+	}
+	static TraceRing& threadRing() {
+		thread_local TraceRing* ring = registerRing();
+		return *ring;
+	}
+	static void record(const char* name, uint64_t begin, uint64_t end) {
+		threadRing().push({ name, begin, end - begin });
+	}
+	// Safe while other threads record: their rings are emptied by themselves.
+	static void clear() {
+		TraceRing::clears.fetch_add(1, std::memory_order_acq_rel);
+	}
+	// Events still being overwritten by a running producer while dumping may
+	// come out torn; dump from the producing thread or between frames.
+	static bool dumpChromeTrace(const std::string& fn) {
+		std::ofstream os(fn);
+		if (!os.is_open()) {
+			std::cerr << "[ERROR] Trace file: " << fn << " could not be opened\n";
+			return false;
+		}
+		os << std::fixed << std::setprecision(3);
+		os << "{\"traceEvents\":[\n";
+		bool first = true;
+		std::lock_guard<std::mutex> lock(registryMutex());
+		for (auto& r : rings()) {
+			if (r->stale()) continue;
+			uint64_t h = r->head.load(std::memory_order_acquire);
+			uint64_t n = h < TraceRing::CAPACITY ? h : TraceRing::CAPACITY;
+			for (uint64_t i = h - n; i < h; i++) {
+				const TraceEvent& e = r->events[i & (TraceRing::CAPACITY - 1)];
+				if (!first) os << ",\n";
+				first = false;
+				os << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << r->tid
+				   << ",\"ts\":" << e.begin / 1000.0 << ",\"dur\":" << e.dur / 1000.0 << "}";
+			}
+		}
+		os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+		return true;
+	}
+
+private:
+	static std::mutex& registryMutex() {
+		static std::mutex m;
+		return m;
+	}
+	// Rings are never freed so events of finished threads survive until dumped.
+	static std::vector<std::unique_ptr<TraceRing>>& rings() {
+		static std::vector<std::unique_ptr<TraceRing>> r;
+		return r;
+	}
+	static TraceRing* registerRing() {
+		std::lock_guard<std::mutex> lock(registryMutex());
+		rings().push_back(std::make_unique<TraceRing>());
+		rings().back()->tid = (int)rings().size() - 1;
+		return rings().back().get();
+	}
+};
+
+struct ScopedTimer {
+	const char* name;
+	uint64_t begin = 0;
+	bool active;
+	ScopedTimer(const char* n) : name(n), active(Profiler::enabled.load(std::memory_order_relaxed)) {
+		if (active) begin = Profiler::now();
+	}
+	~ScopedTimer() {
+		if (active) Profiler::record(name, begin, Profiler::now());
+	}
+};
+
+#ifdef ENABLE_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(__profileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#endif
+
+#endif /* Profiler_hpp */
@@ -0,0 +1,126 @@
+//
+//  bench.cpp
+//  BVH_Render
+//
+//  Microbenchmarks for Body::readBVH, assignMotion and update on synthetic
+//  skeletons. Prints a table to stderr and one JSON record per skeleton to
+//  stdout (or to the file given with --out), so runs can be diffed over time.
+//
+//  usage: bench [--bones 20,50,100,200,500] [--frames N] [--depth D]
+//               [--order ZXY|random] [--reps N] [--out results.json]
+//               [--emit file.bvh]   (write one synthetic file and exit)
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <vector>
+#include "bvh.hpp"
+#include "bvhgen.hpp"
+
+static double seconds(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+	return std::chrono::duration<double>(b - a).count();
+}
+
+static std::vector<int> parseList(const std::string& s) {
+	std::vector<int> r;
+	std::stringstream ss(s);
+	std::string tok;
+	while (std::getline(ss, tok, ','))
+		r.push_back(atoi(tok.c_str()));
+	return r;
+}
+
+int main(int argc, const char* argv[]) {
+	std::vector<int> boneCounts = { 20, 50, 100, 200, 500 };
+	SyntheticBVH opt;
+	int reps = 5;
+	std::string outFn, emitFn;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string a = argv[i];
+		if (a == "--bones") boneCounts = parseList(argv[i + 1]);
+		else if (a == "--frames") opt.nFrames = atoi(argv[i + 1]);
+		else if (a == "--depth") opt.maxDepth = atoi(argv[i + 1]);
+		else if (a == "--order") opt.channelOrder = argv[i + 1];
+		else if (a == "--reps") reps = atoi(argv[i + 1]);
+		else if (a == "--out") outFn = argv[i + 1];
+		else if (a == "--emit") emitFn = argv[i + 1];
+		else {
+			std::cerr << "[ERROR] Unknown option: " << a << std::endl;
+			return 1;
+		}
+	}
+	if (!emitFn.empty()) {
+		opt.nBones = boneCounts.empty() ? opt.nBones : boneCounts[0];
+		std::ofstream os(emitFn);
+		writeSyntheticBVH(os, opt);
+		return 0;
+	}
+
+	std::ofstream outFile;
+	if (!outFn.empty()) outFile.open(outFn);
+	std::ostream& out = outFn.empty() ? std::cout : outFile;
+	const std::string tmpFn = "bench_tmp.bvh";
+	std::streambuf* coutBuf = std::cout.rdbuf();
+
+	fprintf(stderr, "%6s %8s %10s %12s %12s\n", "bones", "frames", "parse MB/s", "assign ns", "update ns");
+	for (int nBones : boneCounts) {
+		opt.nBones = nBones;
+		{
+			std::ofstream os(tmpFn);
+			writeSyntheticBVH(os, opt);
+		}
+		std::ifstream probe(tmpFn, std::ios::binary | std::ios::ate);
+		double fileBytes = (double)probe.tellg();
+		probe.close();
+
+		// readBVH logs every joint to std::cout; keep that out of the timing.
+		double parseTime = 1e30;
+		Body body;
+		for (int r = 0; r < reps; r++) {
+			Body b;
+			std::cout.rdbuf(nullptr);
+			auto t0 = std::chrono::steady_clock::now();
+			b.readBVH(tmpFn);
+			auto t1 = std::chrono::steady_clock::now();
+			std::cout.clear();
+			std::cout.rdbuf(coutBuf);
+			parseTime = std::min(parseTime, seconds(t0, t1));
+			if (r == reps - 1) body = b;
+		}
+
+		int nFrames = body.getNFrames();
+		int iters = std::max(nFrames, 2000000 / (int)body.bones.size());
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < iters; i++)
+			body.assignMotion(i % nFrames);
+		auto t1 = std::chrono::steady_clock::now();
+		double assignNs = seconds(t0, t1) * 1e9 / iters;
+
+		float checksum = 0;
+		t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < iters; i++) {
+			body.bones[0].tr.x = (float)(i & 7);	// keep the compiler from hoisting the loop
+			body.update();
+			checksum += body.bones.back().gp.x;
+		}
+		t1 = std::chrono::steady_clock::now();
+		double updateNs = seconds(t0, t1) * 1e9 / iters;
+
+		double parseMBs = fileBytes / parseTime / (1024 * 1024);
+		fprintf(stderr, "%6d %8d %10.2f %12.1f %12.1f\n", (int)body.bones.size(), nFrames, parseMBs, assignNs, updateNs);
+		out << "{\"joints\":" << nBones << ",\"bones\":" << body.bones.size()
+			<< ",\"frames\":" << nFrames << ",\"channels\":" << body.m_totalChannels
+			<< ",\"order\":\"" << opt.channelOrder << "\",\"bytes\":" << (long long)fileBytes
+			<< ",\"parse_s\":" << parseTime << ",\"parse_MBps\":" << parseMBs
+			<< ",\"assign_ns\":" << assignNs << ",\"update_ns\":" << updateNs
+			<< ",\"checksum\":" << checksum << "}" << std::endl;
+	}
+	std::remove(tmpFn.c_str());
+	return 0;
+}
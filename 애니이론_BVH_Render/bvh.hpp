@@ -7,7 +7,15 @@
 #include <iostream>
 #include <vector>
 #include <glm/gtx/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include "GLTools.hpp"
+#include "Profiler.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_USE_SSE
+#endif
 
 const float OFFSET_SCALE = 5.f;
 
@@ -16,6 +24,11 @@ inline glm::vec3 rotate(const glm::quat& q, const glm::vec3& v) {
 	return glm::vec3(tmp.x, tmp.y, tmp.z);
 }
 
+struct LinkArena;
+
+// Joint of a Link hierarchy. All links of one hierarchy live in a single
+// LinkArena and refer to each other by index, so traversal is a linear walk
+// over the arena's DFS order instead of a recursive pointer chase.
 struct Link {
 	enum class CHANNEL_TYPE {
 		X_POSITION,
@@ -25,81 +38,198 @@ struct Link {
 		Y_ROTATION,
 		Z_ROTATION,
 	};
+	static const int MAX_CHANNELS = 6;
 
 	glm::vec3 offset;
 	std::string name;
-	std::vector<CHANNEL_TYPE> channelTypes;
-	std::vector<Link*> children;
+	CHANNEL_TYPE channelTypes[MAX_CHANNELS];
+	int nChannels = 0;
 
-	glm::vec3 tr;
+	glm::vec3 tr = glm::vec3(0, 0, 0);
 	glm::quat ro = glm::quat(1, 0, 0, 0);
 
-	Link* parent = nullptr;
-	~Link() {
-		for (int i = 0; i < children.size(); i++)
-			delete children[i];
-		children.clear();
-	}
-	void addChild(Link* l) {
-		children.push_back(l);
-	}
-	void print(std::ostream& os, int t) {
-		for (int i = 0; i < t; i++) os << " ";
-		os << name << std::endl;
-		for (auto child : children)
-			child->print(os, t + 1);
-	}
-	static Link* readJoint(std::istream& is, Link* parent) {
-		Link* link = new Link();
+	LinkArena* arena = nullptr;
+	int id = -1;
+	int parent = -1;
+	int firstChild = -1;
+	int lastChild = -1;
+	int nextSibling = -1;
+	int depth = 0;
+	int dfsBegin = 0;	// position in LinkArena::order
+	int dfsEnd = 0;		// one past the last descendant in LinkArena::order
+
+	inline void print(std::ostream& os, int t);
+	inline void draw(const glm::vec3& pp, const glm::quat& pq);
+
+	static inline Link* readJoint(std::istream& is, LinkArena& arena);
+	static inline Link* readJoint(std::istream& is, Link* parent);
+	static inline Link* readEndSite(std::istream& is, Link* parent);
+
+	static void readHeader(std::istream& is, Link& link) {
 		std::string tmp;
-		int nChannels;
-		is >> link->name;
+		int n;
+		is >> link.name;
 		is >> tmp; // {
 		is >> tmp; // OFFSET
-		is >> link->offset.x >> link->offset.y >> link->offset.z;
-		link->offset *= OFFSET_SCALE;
+		is >> link.offset.x >> link.offset.y >> link.offset.z;
+		link.offset *= OFFSET_SCALE;
 		is >> tmp; // CHANNELS
-		is >> nChannels;
-		for (int i = 0; i < nChannels; i++) {
+		is >> n;
+		for (int i = 0; i < n; i++) {
 			is >> tmp;
-			if (tmp.compare("Xposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::X_POSITION);
-			else if (tmp.compare("Yposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Y_POSITION);
-			else if (tmp.compare("Zposition") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Z_POSITION);
-			else if (tmp.compare("Xrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::X_ROTATION);
-			else if (tmp.compare("Yrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Y_ROTATION);
-			else if (tmp.compare("Zrotation") == 0) link->channelTypes.push_back(CHANNEL_TYPE::Z_ROTATION);
-		}
-		while (true) {
-			is >> tmp; // JOINT, End, or }
-			if (tmp.compare("JOINT") == 0) link->addChild(readJoint(is, link));
-			else if (tmp.compare("End") == 0) link->addChild(readEndSite(is, link));
-			else if (tmp.compare("}") == 0) break;
+			CHANNEL_TYPE c;
+			if (tmp.compare("Xposition") == 0) c = CHANNEL_TYPE::X_POSITION;
+			else if (tmp.compare("Yposition") == 0) c = CHANNEL_TYPE::Y_POSITION;
+			else if (tmp.compare("Zposition") == 0) c = CHANNEL_TYPE::Z_POSITION;
+			else if (tmp.compare("Xrotation") == 0) c = CHANNEL_TYPE::X_ROTATION;
+			else if (tmp.compare("Yrotation") == 0) c = CHANNEL_TYPE::Y_ROTATION;
+			else if (tmp.compare("Zrotation") == 0) c = CHANNEL_TYPE::Z_ROTATION;
+			else continue;
+			if (link.nChannels < MAX_CHANNELS) link.channelTypes[link.nChannels++] = c;
 		}
-		return link;
 	}
-	static Link* readEndSite(std::istream& is, Link* parent) {
-		Link* link = new Link();
+	static void readEndSiteBody(std::istream& is, Link& link) {
 		std::string tmp;
-		is >> tmp; // Site
-		is >> link->name;
+		is >> link.name; // Site
 		is >> tmp; // {
 		is >> tmp; // OFFSET
-		is >> link->offset.x >> link->offset.y >> link->offset.z;
-		link->offset *= OFFSET_SCALE;
+		is >> link.offset.x >> link.offset.y >> link.offset.z;
+		link.offset *= OFFSET_SCALE;
 		is >> tmp; // }
-		return link;
 	}
-	void draw(const glm::vec3& pp, const glm::quat& pq) {
-		glm::quat q = pq * ro;
-		glm::vec3 p = rotate(q, offset) + pp + tr;
-		glm::mat4 m = translate(p);
-		drawCylinder(p, pp, 1, glm::vec4(1, 0.3, 0, 1));
-		drawSphere(p, 2, glm::vec4(1, 1, 0, 1));
-		for (auto child : children)
-			child->draw(p, q);
+};
+
+// Owns every Link of a hierarchy. Links are stored contiguously and addressed
+// by index; `order` lists them in depth-first order so that a parent always
+// precedes its descendants and every subtree is a contiguous range.
+struct LinkArena {
+	std::vector<Link> links;
+	std::vector<int> order;
+	std::vector<glm::vec3> gp;
+	std::vector<glm::quat> gq;
+	bool orderDirty = false;
+
+	// Every Link points back at its arena, so an arena stays where it was built.
+	LinkArena() = default;
+	LinkArena(const LinkArena&) = delete;
+	LinkArena(LinkArena&&) = delete;
+	LinkArena& operator=(const LinkArena&) = delete;
+	LinkArena& operator=(LinkArena&&) = delete;
+
+	// Note: Link pointers are invalidated when the arena grows.
+	int add(int parent) {
+		int id = (int)links.size();
+		links.push_back(Link());
+		Link& l = links.back();
+		l.arena = this;
+		l.id = id;
+		l.parent = parent;
+		if (parent >= 0) {
+			Link& p = links[parent];
+			l.depth = p.depth + 1;
+			if (p.lastChild >= 0) links[p.lastChild].nextSibling = id;
+			else p.firstChild = id;
+			p.lastChild = id;
+		}
+		orderDirty = true;
+		return id;
+	}
+	// Iterative (stack-free) pre-order walk over firstChild/nextSibling links.
+	void updateOrder() {
+		if (!orderDirty) return;
+		order.clear();
+		order.reserve(links.size());
+		for (int r = 0; r < (int)links.size(); r++) {
+			if (links[r].parent >= 0) continue;
+			int n = r;
+			while (true) {
+				links[n].dfsBegin = (int)order.size();
+				order.push_back(n);
+				if (links[n].firstChild >= 0) {
+					n = links[n].firstChild;
+					continue;
+				}
+				while (true) {
+					links[n].dfsEnd = (int)order.size();
+					if (n == r) break;
+					if (links[n].nextSibling >= 0) {
+						n = links[n].nextSibling;
+						break;
+					}
+					n = links[n].parent;
+				}
+				if (n == r) break;
+			}
+		}
+		orderDirty = false;
+	}
+	// Parses a JOINT/ROOT block (name onwards) and all of its descendants.
+	int parseJoint(std::istream& is, int parent) {
+		std::vector<int> open;
+		std::string tmp;
+		int root = add(parent);
+		Link::readHeader(is, links[root]);
+		open.push_back(root);
+		while (!open.empty() && (is >> tmp)) { // JOINT, End, or }
+			if (tmp.compare("JOINT") == 0) {
+				int j = add(open.back());
+				Link::readHeader(is, links[j]);
+				open.push_back(j);
+			}
+			else if (tmp.compare("End") == 0) Link::readEndSiteBody(is, links[add(open.back())]);
+			else if (tmp.compare("}") == 0) open.pop_back();
+		}
+		return root;
+	}
+	void clear() {
+		links.clear();
+		order.clear();
+		gp.clear();
+		gq.clear();
+		orderDirty = false;
 	}
 };
 
+inline Link* Link::readJoint(std::istream& is, LinkArena& arena) {
+	return &arena.links[arena.parseJoint(is, -1)];
+}
+inline Link* Link::readJoint(std::istream& is, Link* parent) {
+	LinkArena& arena = *parent->arena;
+	return &arena.links[arena.parseJoint(is, parent->id)];
+}
+inline Link* Link::readEndSite(std::istream& is, Link* parent) {
+	LinkArena& arena = *parent->arena;
+	int id = arena.add(parent->id);
+	readEndSiteBody(is, arena.links[id]);
+	return &arena.links[id];
+}
+inline void Link::print(std::ostream& os, int t) {
+	arena->updateOrder();
+	for (int i = dfsBegin; i < dfsEnd; i++) {
+		const Link& l = arena->links[arena->order[i]];
+		for (int k = 0; k < t + l.depth - depth; k++) os << " ";
+		os << l.name << std::endl;
+	}
+}
+inline void Link::draw(const glm::vec3& pp, const glm::quat& pq) {
+	arena->updateOrder();
+	std::vector<glm::vec3>& gp = arena->gp;
+	std::vector<glm::quat>& gq = arena->gq;
+	gp.resize(arena->links.size());
+	gq.resize(arena->links.size());
+	for (int i = dfsBegin; i < dfsEnd; i++) {
+		const Link& l = arena->links[arena->order[i]];
+		glm::vec3 ppos = (l.id == id) ? pp : gp[l.parent];
+		glm::quat pro = (l.id == id) ? pq : gq[l.parent];
+		glm::quat q = pro * l.ro;
+		glm::vec3 p = rotate(q, l.offset) + ppos + l.tr;
+		gp[l.id] = p;
+		gq[l.id] = q;
+		drawCylinder(p, ppos, 1, glm::vec4(1, 0.3, 0, 1));
+		drawSphere(p, 2, glm::vec4(1, 1, 0, 1));
+	}
+}
+
 
 struct Bone {
 	enum class CHANNEL_TYPE {
@@ -130,13 +260,16 @@ struct Body {
 	int m_totalChannels = 0;
 	int m_NFrames;
 	float m_FrameRate;
+
+	enum class INTERPOLATION { NLERP, SLERP };
+	INTERPOLATION interpolation = INTERPOLATION::NLERP;
+
 	void readEndSite(std::istream& is, int parent) {
 		bones.push_back(Bone());
 		Bone& bone = bones.back();
 		bone.parent = parent;
 		std::string tmp;
-		is >> tmp; // Site
-		is >> bone.name; std::cout << bone.name << std::endl;
+		is >> bone.name; std::cout << bone.name << std::endl; // Site
 		is >> tmp; // {
 		is >> tmp; // OFFSET
 		is >> bone.offset.x >> bone.offset.y >> bone.offset.z;
@@ -145,7 +278,9 @@ struct Body {
 	}
 
 	void readBVH(const std::string& fn) {
+		PROFILE_SCOPE("parse");
 		std::ifstream is(fn);
+		if (!is.is_open()) return;	// no bones: the caller reports it
 		std::stack<int> parent;
 		std::string tmp;
 
@@ -154,6 +289,7 @@ struct Body {
 		while (bones.size() == 0 || !parent.empty()) {
 
 			is >> tmp; // JOINT, End, or }
+			if (!is) return;	// truncated or not a BVH file
 
 			if (tmp.compare("JOINT") == 0 || tmp.compare("ROOT") == 0) {
 
@@ -183,8 +319,8 @@ struct Body {
 				dataIndex += nChannels;
 				parent.push(bones.size() - 1);
 			}
-			else if (tmp.compare("End") == 0) readEndSite(is, parent.top());
-			else if (tmp.compare("}") == 0)
+			else if (tmp.compare("End") == 0 && !parent.empty()) readEndSite(is, parent.top());
+			else if (tmp.compare("}") == 0 && !parent.empty())
 				parent.pop();
 		}
 
@@ -204,74 +340,161 @@ struct Body {
 		std::cout << bones.size() << std::endl;
 		while (i++ < m_NFrames * m_totalChannels) {
 			float tmp;
-			is >> tmp;
+			if (!(is >> tmp)) {
+				motions.clear();	// a clip cut short is not played
+				break;
+			}
 			motions.push_back(tmp);
 		}
 		std::cout << motions.size() << std::endl;
 	}
 
 
+	// Decodes the channels of `bone` from one frame of motion data into tr/ro.
+	// Components without a channel keep the value passed in.
+	static void decodeChannels(const Bone& bone, const float* frameData, glm::vec3& tr, glm::quat& ro)
+	{
+		glm::vec3 eulerAngle(0.f);
+		// dataOffset : current Bone   ġ
+		size_t start = bone.dataOffset;
+		size_t sz = bone.channelTypes.size();
+		bool isRot = false;
+		for (auto i = 0; i < sz; ++i) {
+			// 3  0 1 2
+			// 6  0 1 2 3 4 5
+			auto& channel = bone.channelTypes[i];
+			const float& curMotion = frameData[start + i];
+			switch (channel) {
+			case Bone::CHANNEL_TYPE::X_POSITION:
+				tr.x = curMotion * OFFSET_SCALE;
+				break;
+			case Bone::CHANNEL_TYPE::Y_POSITION:
+				tr.y = curMotion * OFFSET_SCALE;
+				break;
+			case Bone::CHANNEL_TYPE::Z_POSITION:
+				tr.z = curMotion * OFFSET_SCALE;
+				break;
+			case Bone::CHANNEL_TYPE::X_ROTATION:
+				isRot = true;
+				eulerAngle.x = glm::radians(curMotion);
+				break;
+			case Bone::CHANNEL_TYPE::Y_ROTATION:
+				isRot = true;
+				eulerAngle.y = glm::radians(curMotion);
+				break;
+			case Bone::CHANNEL_TYPE::Z_ROTATION:
+				isRot = true;
+				eulerAngle.z = glm::radians(curMotion);
+				break;
+			default:
+				break;
+			}
+		}
+		if (isRot) {
+			float c1 = cosf(eulerAngle.x / 2);
+			float c2 = cosf(eulerAngle.y / 2);
+			float c3 = cosf(eulerAngle.z / 2);
+			float s1 = sinf(eulerAngle.x / 2);
+			float s2 = sinf(eulerAngle.y / 2);
+			float s3 = sinf(eulerAngle.z / 2);
+
+			ro.w = c1 * c2 * c3 - s1 * s2 * s3;
+			ro.x = s1 * c2 * c3 - c1 * s2 * s3;
+			ro.y = c1 * s2 * c3 + s1 * c2 * s3;
+			ro.z = c1 * c2 * s3 + s1 * s2 * c3;
+		}
+	}
+
 	void assignMotion(int curFrame)
 	{
+		PROFILE_SCOPE("assign");
+		// curOffset :    motions   ġ
 		size_t curOffset = curFrame* m_totalChannels; // 0 : 0    1 : 75
-		glm::vec3 eulerAngle(0.f);
+		for (auto& bone : bones)
+			decodeChannels(bone, &motions[curOffset], bone.tr, bone.ro);
+	}
+
+	// Blends unit quaternions along the shorter arc. nlerp by default; with
+	// useSlerp the weights follow the great arc (falls back to nlerp when the
+	// rotations are nearly equal). The weighted sum and normalization run on SSE.
+	static glm::quat interpolate(const glm::quat& a, const glm::quat& b, float t, bool useSlerp = false) {
+		float d = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+		float w0 = 1 - t, w1 = t;
+		if (d < 0) {
+			d = -d;
+			w1 = -w1;
+		}
+		if (useSlerp && d < 0.9995f) {
+			float theta = acosf(d);
+			float s = 1 / sinf(theta);
+			w0 = sinf((1 - t) * theta) * s;
+			w1 = (w1 < 0 ? -1 : 1) * sinf(t * theta) * s;
+		}
+		glm::quat r;
+#ifdef BVH_USE_SSE
+		__m128 q = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(glm::value_ptr(a)), _mm_set1_ps(w0)),
+			_mm_mul_ps(_mm_loadu_ps(glm::value_ptr(b)), _mm_set1_ps(w1)));
+		__m128 sq = _mm_mul_ps(q, q);
+		sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+		sq = _mm_add_ps(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_ps(glm::value_ptr(r), _mm_div_ps(q, _mm_sqrt_ps(sq)));
+#else
+		r = a * w0 + b * w1;
+		r = r * (1 / sqrtf(r.x * r.x + r.y * r.y + r.z * r.z + r.w * r.w));
+#endif
+		return r;
+	}
+
+	// Poses the body at `time` seconds by blending the two nearest frames:
+	// translations are lerped, rotations nlerped (or slerped) on the short arc.
+	// Unlike assignMotion this stays smooth for slow playback and decimated clips.
+	void sample(float time)
+	{
+		PROFILE_SCOPE("sample");
+		if (m_NFrames <= 0 || motions.empty()) return;
+		float f = time / m_FrameRate;
+		if (!(f > 0)) f = 0;
+		if (f > m_NFrames - 1) f = (float)(m_NFrames - 1);
+		int f0 = (int)f;
+		int f1 = std::min(f0 + 1, m_NFrames - 1);
+		float t = f - f0;
+		const float* d0 = &motions[(size_t)f0 * m_totalChannels];
+		const float* d1 = &motions[(size_t)f1 * m_totalChannels];
+		bool useSlerp = interpolation == INTERPOLATION::SLERP;
 		for (auto& bone : bones) {
-			// dataOffset : current Bone   ġ
-			// curOffset :    motions   ġ
-			size_t start = curOffset + bone.dataOffset;
-			size_t sz = bone.channelTypes.size();
-			bool isRot = false;
-			for (auto i = 0; i < sz; ++i) {
-				// 3  0 1 2
-				// 6  0 1 2 3 4 5
-				auto& channel = bone.channelTypes[i];
-				auto& curMotion = motions[start + i];
-				switch (channel) {
-				case Bone::CHANNEL_TYPE::X_POSITION:
-					bone.tr.x = curMotion * OFFSET_SCALE;
-					break;
-				case Bone::CHANNEL_TYPE::Y_POSITION:
-					bone.tr.y = curMotion * OFFSET_SCALE;
-					break;
-				case Bone::CHANNEL_TYPE::Z_POSITION:
-					bone.tr.z = curMotion * OFFSET_SCALE;
-					break;
-				case Bone::CHANNEL_TYPE::X_ROTATION:
-					isRot = true;
-					eulerAngle.x = glm::radians(curMotion);
-					break;
-				case Bone::CHANNEL_TYPE::Y_ROTATION:
-					isRot = true;
-					eulerAngle.y = glm::radians(curMotion);
-					break;
-				case Bone::CHANNEL_TYPE::Z_ROTATION:
-					isRot = true;
-					eulerAngle.z = glm::radians(curMotion);
-					break;
-				default:
-					break;
-				}
-			}
-			if (isRot) {
-				float c1 = cosf(eulerAngle.x / 2);
-				float c2 = cosf(eulerAngle.y / 2);
-				float c3 = cosf(eulerAngle.z / 2);
-				float s1 = sinf(eulerAngle.x / 2);
-				float s2 = sinf(eulerAngle.y / 2);
-				float s3 = sinf(eulerAngle.z / 2);
-
-				bone.ro.w = c1 * c2 * c3 - s1 * s2 * s3;
-				bone.ro.x = s1 * c2 * c3 - c1 * s2 * s3;
-				bone.ro.y = c1 * s2 * c3 + s1 * c2 * s3;
-				bone.ro.z = c1 * c2 * s3 + s1 * s2 * c3;
-
-				eulerAngle = glm::vec3(0.f);
-			}
+			glm::vec3 tr0 = bone.tr, tr1 = bone.tr;
+			glm::quat ro0 = bone.ro, ro1 = bone.ro;
+			decodeChannels(bone, d0, tr0, ro0);
+			decodeChannels(bone, d1, tr1, ro1);
+			bone.tr = tr0 + (tr1 - tr0) * t;
+			bone.ro = interpolate(ro0, ro1, t, useSlerp);
+		}
+	}
+
+	// Keeps about every `factor`-th frame, always including the first and the
+	// last, and scales the frame time to match, so the clip plays just as long
+	// through sample() with less motion data. When factor does not divide the
+	// frame count the kept frames are the nearest to an even spacing.
+	void decimate(int factor)
+	{
+		if (factor <= 1 || m_NFrames <= 1) return;
+		int last = m_NFrames - 1;
+		int n = (last + factor - 1) / factor + 1;
+		for (int f = 1; f < n; f++) {
+			size_t src = ((size_t)f * last * 2 + (n - 1)) / (2 * (size_t)(n - 1));
+			std::copy(motions.begin() + src * m_totalChannels,
+				motions.begin() + (src + 1) * m_totalChannels,
+				motions.begin() + (size_t)f * m_totalChannels);
 		}
+		motions.resize((size_t)n * m_totalChannels);
+		motions.shrink_to_fit();
+		m_FrameRate *= (float)last / (n - 1);
+		m_NFrames = n;
 	}
 
 
 	void update() {
+		PROFILE_SCOPE("FK");
 		for (auto& b : bones) {
 			if (b.parent >= 0) {
 				b.gq = bones[b.parent].gq * b.ro;
@@ -285,6 +508,7 @@ struct Body {
 	}
 	void draw() {
 		update();
+		PROFILE_SCOPE("draw submission");
 		for (auto& b : bones) {
 			if (b.parent >= 0)
 				drawCylinder(b.gp, bones[b.parent].gp, 1, glm::vec4(1, 0, 0, 1));
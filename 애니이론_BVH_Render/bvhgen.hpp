@@ -0,0 +1,107 @@
+//
+//  bvhgen.hpp
+//  BVH_Render
+//
+//  Synthetic BVH writer used by the benchmarks: random skeleton with a given
+//  joint count, depth limit and channel order, plus random motion data.
+//
+
+#ifndef bvhgen_hpp
+#define bvhgen_hpp
+
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+struct SyntheticBVH {
+	int nBones = 20;				// JOINT/ROOT count, End Sites not included
+	int maxDepth = 8;				// root is depth 0
+	std::string channelOrder = "ZXY";	// rotation order, or "random" per joint
+	bool rootPosition = true;		// root gets X/Y/Z position channels
+	bool jointPosition = false;		// every joint gets position channels
+	bool endSites = true;			// End Site below every leaf joint
+	int nFrames = 120;
+	float frameTime = 1 / 120.f;
+	unsigned seed = 1;
+};
+
+static inline void writeSyntheticBVH(std::ostream& os, const SyntheticBVH& opt) {
+	static const char* orders[] = { "XYZ", "XZY", "YXZ", "YZX", "ZXY", "ZYX" };
+	std::mt19937 rng(opt.seed);
+	std::uniform_real_distribution<float> offsetDist(-10.f, 10.f);
+	std::uniform_real_distribution<float> angleDist(-90.f, 90.f);
+	std::uniform_real_distribution<float> posDist(-50.f, 50.f);
+
+	int n = opt.nBones < 1 ? 1 : opt.nBones;
+	std::vector<int> parent(n, -1), depth(n, 0);
+	std::vector<std::vector<int>> children(n);
+	std::vector<std::string> order(n);
+	std::vector<int> open;	// joints that may still take children
+	open.push_back(0);
+	for (int i = 1; i < n; i++) {
+		int k = std::uniform_int_distribution<int>(0, (int)open.size() - 1)(rng);
+		int p = open[k];
+		parent[i] = p;
+		depth[i] = depth[p] + 1;
+		children[p].push_back(i);
+		if (depth[i] < opt.maxDepth) open.push_back(i);
+	}
+	for (int i = 0; i < n; i++)
+		order[i] = opt.channelOrder == "random" ? orders[rng() % 6] : opt.channelOrder;
+
+	std::vector<int> nChannels(n);
+	os << "HIERARCHY\n";
+	// Iterative pre-order write; a negative entry closes joint -entry-1.
+	std::vector<int> stack = { 0 };
+	while (!stack.empty()) {
+		int e = stack.back();
+		stack.pop_back();
+		if (e < 0) {
+			int j = -e - 1;
+			if (opt.endSites && children[j].empty())
+				os << std::string(depth[j] + 1, '\t') << "End Site\n"
+				   << std::string(depth[j] + 1, '\t') << "{\n"
+				   << std::string(depth[j] + 2, '\t') << "OFFSET " << offsetDist(rng) << " " << offsetDist(rng) << " " << offsetDist(rng) << "\n"
+				   << std::string(depth[j] + 1, '\t') << "}\n";
+			os << std::string(depth[j], '\t') << "}\n";
+			continue;
+		}
+		std::string ind(depth[e], '\t');
+		bool pos = opt.jointPosition || (e == 0 && opt.rootPosition);
+		nChannels[e] = pos ? 6 : 3;
+		os << ind << (e == 0 ? "ROOT" : "JOINT") << " Joint" << e << "\n" << ind << "{\n";
+		os << ind << "\tOFFSET " << offsetDist(rng) << " " << offsetDist(rng) << " " << offsetDist(rng) << "\n";
+		os << ind << "\tCHANNELS " << nChannels[e];
+		if (pos) os << " Xposition Yposition Zposition";
+		for (char c : order[e]) os << " " << c << "rotation";
+		os << "\n";
+		stack.push_back(-e - 1);
+		for (int c = (int)children[e].size() - 1; c >= 0; c--)
+			stack.push_back(children[e][c]);
+	}
+
+	// Channels are written in hierarchy (pre-order) order, as readers expect.
+	std::vector<int> preorder;
+	stack = { 0 };
+	while (!stack.empty()) {
+		int e = stack.back();
+		stack.pop_back();
+		preorder.push_back(e);
+		for (int c = (int)children[e].size() - 1; c >= 0; c--)
+			stack.push_back(children[e][c]);
+	}
+	os << "MOTION\n";
+	os << "Frames: " << opt.nFrames << "\n";
+	os << "Frame Time: " << opt.frameTime << "\n";
+	for (int f = 0; f < opt.nFrames; f++) {
+		for (int j : preorder) {
+			if (nChannels[j] == 6)
+				os << posDist(rng) << " " << posDist(rng) << " " << posDist(rng) << " ";
+			os << angleDist(rng) << " " << angleDist(rng) << " " << angleDist(rng) << " ";
+		}
+		os << "\n";
+	}
+}
+
+#endif /* bvhgen_hpp */
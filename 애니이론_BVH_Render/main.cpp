@@ -8,6 +8,7 @@
 #include <iostream>
 #include <JGL/JGL_Window.hpp>
 #include "AnimView.hpp"
+#include "Headless.hpp"
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/transform.hpp>
 #include "bvh.hpp"
@@ -28,6 +29,7 @@ void drawK(glm::vec3 pos, float sz = 1, const glm::vec4& color = glm::vec4(1, 0.
 
 
 
+LinkArena skeleton;
 Link* body;
 
 void readBVH(const std::string& fn) {
@@ -35,43 +37,91 @@ void readBVH(const std::string& fn) {
 	std::string tmp;
 	ifs >> tmp; // HIERARCHY
 	ifs >> tmp; // Root
-	body = Link::readJoint(ifs, nullptr);
+	body = Link::readJoint(ifs, skeleton);
 	body->print(std::cout, 0);
 	ifs.close();
 }
 Body b;
-
+bool bodyLoaded = false;
+void init();
+
+// Parses the clip on the worker pool and publishes it on the GL thread, so the
+// window comes up immediately regardless of clip size.
+AsyncLoad loadBody(std::string fn) {
+	co_await resumeOnWorker();
+	Body loaded;
+	loaded.readBVH(fn);
+	co_await resumeOnGL();
+	if (loaded.bones.empty() || loaded.motions.empty()) {
+		std::cerr << "[ERROR] BVH file: " << fn << " could not be loaded\n";
+		AsyncLoader::failed() = true;
+		co_return;
+	}
+	b = std::move(loaded);
+	//	body->tr = glm::vec3(0,30,0);
+	b.bones[0].tr = glm::vec3(0, 30, 0);
+	bodyLoaded = true;
+	init();
+	animView->redraw();
+}
 
 
 void render() {
+	PROFILE_SCOPE("render");
+	beginStatic();
 	drawQuad(glm::vec3(0), glm::vec3(0, 1, 0), glm::vec2(1000, 1000), glm::vec4(0, 0, 1, 1));
+	endStatic();
 	//	body->draw(vec3(0), quat(1,vec3(0)));
 	b.draw();
 }
 
 void frame(float t) {
-	frameCount = std::min(b.getNFrames() - 1, (int)std::round(animView->progress() / b.getFrameRate()));
-	b.assignMotion(frameCount);
+	PROFILE_SCOPE("frame");
+	if (!bodyLoaded) return;
+	b.sample(animView->progress());
+}
+
+void keyFunc(int key) {
+	if (key == 'T')
+		Profiler::dumpChromeTrace("trace.json");
 }
 
 void init() {
 	frameCount = 0;
-	b.assignMotion(frameCount);
+	if (bodyLoaded)
+		b.assignMotion(frameCount);
 }
 
 int main(int argc, const char* argv[]) {
 	//	readBVH( "BackKickA.bvh" );
-	b.readBVH("BackKickA.bvh");
-	//	body->tr = glm::vec3(0,30,0);
-	b.bones[0].tr = glm::vec3(0, 30, 0);
+	// usage: main [clip.bvh] [--headless ...], see Headless.hpp
+	std::string clip = "BackKickA.bvh";
+	for (int i = 1; i < argc; i++) {
+		std::string a = argv[i];
+		if (a.size() > 4 && a.compare(a.size() - 4, 4, ".bvh") == 0) clip = a;
+	}
+	HeadlessOptions headless;
+	if (headless.parse(argc, argv)) {
+		animView = new AnimView(0, 0, headless.width, headless.height);
+		animView->renderFunction = render;
+		animView->frameFunction = frame;
+		animView->initFunction = init;
+		init();
+		loadBody(clip);
+		int result = runHeadless(*animView, headless);
+		delete animView;
+		return result;
+	}
 	JGL::Window* window = new JGL::Window(640, 480, "simulation");
 	window->alignment(JGL::ALIGN_ALL);
 	animView = new AnimView(0, 0, 640, 480);
 	animView->renderFunction = render;
 	animView->frameFunction = frame;
 	animView->initFunction = init;
+	animView->keyFunction = keyFunc;
 
 	init();
+	loadBody(clip);
 	window->show();
 	JGL::_JGL::run();
 
@@ -32,6 +32,12 @@ struct AnimView: ModelView {
 				}
 				return true;
 			}
+			else if( JGL::_JGL::eventKey() == 'C' ) {
+				// toggles recording of the view into capture.y4m
+				captureOutput = capturedFrames<0 ? "capture.y4m" : "";
+				redraw();
+				return true;
+			}
 			else if( JGL::_JGL::eventKey() == '0' ) {
 				animating = false;
 				initFunction();
@@ -41,10 +47,14 @@ struct AnimView: ModelView {
 		}
 		return ModelView::handle( e );
 	}
+	// Advances the animation by dt; also used with a fixed dt by runHeadless.
+	void step( float dt ) {
+		frameFunction(dt);
+	}
 	virtual void drawContents(NVGcontext* vg, const glm::rect&r, int a ) override {
 		if( animating ) {
 			float t = glfwGetTime();
-			frameFunction(t-lastT);
+			step(t-lastT);
 			animate();
 			lastT = t;
 		}
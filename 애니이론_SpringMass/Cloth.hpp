@@ -0,0 +1,514 @@
+//
+//  Cloth.hpp
+//  SpringMass
+//
+//  Mass-spring state in structure-of-arrays form: positions, velocities,
+//  forces and masses are separate aligned float arrays, so the per-particle
+//  work streams through memory on SIMD lanes (Simd.hpp). Springs are index
+//  pairs with their parameters in parallel arrays and a CSR adjacency per
+//  particle; reorderMorton() renumbers both along a Z-order curve so that
+//  particles close in space are close in memory. A substep is two sweeps:
+//  Springs::addForces() accumulates the spring forces (serially, or on the
+//  Parallel.hpp pool by conflict-free colors or by per-particle gather), then
+//  Particles::integrate() applies gravity and drag, advances with
+//  symplectic Euler, clears the forces and resolves collisions, one SIMD
+//  block at a time.
+//
+
+#ifndef Cloth_hpp
+#define Cloth_hpp
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "GLTools.hpp"
+#include "Parallel.hpp"
+#include "Simd.hpp"
+
+struct Particles {
+	int count = 0;
+	FloatArray px, py, pz;
+	FloatArray vx, vy, vz;
+	FloatArray fx, fy, fz;			// accumulated force, cleared by integrate()
+	FloatArray mass, invMass;		// zero in the padding lanes, which never move
+
+	void clear() {
+		count = 0;
+		for( auto* a: arrays() ) a->clear();
+	}
+	int add( float m, const glm::vec3& position, const glm::vec3& velocity=glm::vec3(0) ) {
+		int i = count++;
+		for( auto* a: arrays() ) a->resize( simdPadded( count ), 0.f );
+		setPosition( i, position );
+		setVelocity( i, velocity );
+		mass[i] = m;
+		invMass[i] = 1/m;
+		return i;
+	}
+	glm::vec3 position( int i ) const { return glm::vec3( px[i], py[i], pz[i] ); }
+	glm::vec3 velocity( int i ) const { return glm::vec3( vx[i], vy[i], vz[i] ); }
+	void setPosition( int i, const glm::vec3& p ) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+	void setVelocity( int i, const glm::vec3& v ) { vx[i] = v.x; vy[i] = v.y; vz[i] = v.z; }
+	void addForce( int i, const glm::vec3& f ) { fx[i] += f.x; fy[i] += f.y; fz[i] += f.z; }
+	// Moves particle order[i] to slot i.
+	void permute( const std::vector<int>& order ) {
+		FloatArray tmp;
+		for( auto* a: arrays() ) {
+			tmp.assign( a->size(), 0.f );
+			for( int i=0; i<count; i++ ) tmp[i] = (*a)[order[i]];
+			a->swap( tmp );
+		}
+	}
+
+	// v += (f + m g - kDrag v)/m dt, x += v dt, f = 0; then collide(x, v) for
+	// each particle of the block while it is still in cache.
+	template<typename Collide>
+	void integrate( const glm::vec3& g, float kDrag, float dt, Collide collide ) {
+		const int W = SimdFloat::WIDTH;
+		const SimdFloat gx( g.x ), gy( g.y ), gz( g.z ), kd( kDrag ), h( dt ), zero( 0.f );
+		const int n = simdPadded( count );
+		for( int b=0; b<n; b+=SIMD_PAD ) {
+			for( int i=b; i<b+SIMD_PAD; i+=W ) {
+				SimdFloat m = SimdFloat::load( &mass[i] ), im = SimdFloat::load( &invMass[i] );
+				SimdFloat vxi = SimdFloat::load( &vx[i] );
+				SimdFloat vyi = SimdFloat::load( &vy[i] );
+				SimdFloat vzi = SimdFloat::load( &vz[i] );
+				vxi = vxi + ( SimdFloat::load( &fx[i] ) + m*gx - kd*vxi )*im*h;
+				vyi = vyi + ( SimdFloat::load( &fy[i] ) + m*gy - kd*vyi )*im*h;
+				vzi = vzi + ( SimdFloat::load( &fz[i] ) + m*gz - kd*vzi )*im*h;
+				vxi.store( &vx[i] ); vyi.store( &vy[i] ); vzi.store( &vz[i] );
+				( SimdFloat::load( &px[i] ) + vxi*h ).store( &px[i] );
+				( SimdFloat::load( &py[i] ) + vyi*h ).store( &py[i] );
+				( SimdFloat::load( &pz[i] ) + vzi*h ).store( &pz[i] );
+				zero.store( &fx[i] ); zero.store( &fy[i] ); zero.store( &fz[i] );
+			}
+			for( int i=b, e=std::min( b+SIMD_PAD, count ); i<e; i++ ) {
+				glm::vec3 x = position( i ), v = velocity( i );
+				collide( x, v );
+				setPosition( i, x );
+				setVelocity( i, v );
+			}
+		}
+	}
+
+private:
+	std::array<FloatArray*,11> arrays() {
+		return { &px, &py, &pz, &vx, &vy, &vz, &fx, &fy, &fz, &mass, &invMass };
+	}
+};
+
+// How Springs::addForces() runs. The serial loop scatters into both
+// endpoints, so it cannot simply be split across threads:
+// SPRINGS_COLORED runs the springs of one color at a time in parallel, no
+// two of which share a particle (needs buildColors()); SPRINGS_GATHERED
+// computes every spring force in parallel and then lets each particle sum
+// its own over the adjacency (needs buildAdjacency()). Both only change
+// the order of the sums, so they match the serial forces to rounding.
+enum SpringEvaluation { SPRINGS_SERIAL, SPRINGS_COLORED, SPRINGS_GATHERED };
+
+// Indices stay valid when particles are added; only reorderMorton() and
+// buildColors() renumber springs.
+struct Springs {
+	std::vector<int> a, b;
+	std::vector<float> restLength, k, kd;
+	// springs touching particle i: adjSpring[adjStart[i]] .. adjSpring[adjStart[i+1]-1],
+	// and the particles at their other ends in adjParticle
+	std::vector<int> adjStart, adjSpring, adjParticle;
+	// springs of color c: colorStart[c] .. colorStart[c+1]-1
+	std::vector<int> colorStart;
+	mutable std::vector<glm::vec3> forces;		// SPRINGS_GATHERED scratch
+
+	int count() const { return (int)a.size(); }
+	void clear() {
+		for( auto* v: { &a, &b, &adjStart, &adjSpring, &adjParticle, &colorStart } ) v->clear();
+		for( auto* v: { &restLength, &k, &kd } ) v->clear();
+	}
+	int add( const Particles& p, int x, int y, float stiffness = 4.8f, float damping = 0.0f ) {
+		a.push_back( x );
+		b.push_back( y );
+		restLength.push_back( length( p.position(x)-p.position(y) ) );
+		k.push_back( stiffness );
+		kd.push_back( damping );
+		return count()-1;
+	}
+	void buildAdjacency( int nParticles ) {
+		adjStart.assign( nParticles+1, 0 );
+		for( int i=0; i<count(); i++ ) {
+			adjStart[a[i]+1]++;
+			adjStart[b[i]+1]++;
+		}
+		for( int i=0; i<nParticles; i++ )
+			adjStart[i+1] += adjStart[i];
+		adjSpring.resize( adjStart[nParticles] );
+		adjParticle.resize( adjStart[nParticles] );
+		std::vector<int> fill( adjStart.begin(), adjStart.end()-1 );
+		for( int i=0; i<count(); i++ ) {
+			adjParticle[fill[a[i]]] = b[i];
+			adjSpring[fill[a[i]]++] = i;
+			adjParticle[fill[b[i]]] = a[i];
+			adjSpring[fill[b[i]]++] = i;
+		}
+	}
+	// Greedy edge coloring: each spring takes the lowest color that no other
+	// spring at either endpoint has. Springs are then grouped by color,
+	// keeping their order within a color, and the adjacency rebuilt. Springs
+	// that find all MAX_COLORS taken go to one extra group run serially.
+	static const int MAX_COLORS = 64;
+	void buildColors( int nParticles ) {
+		std::vector<uint64_t> used( nParticles, 0 );
+		std::vector<int> color( count() );
+		int nColors = 0;
+		for( int i=0; i<count(); i++ ) {
+			uint64_t taken = used[a[i]] | used[b[i]];
+			int c = 0;
+			while( c < MAX_COLORS && ( taken>>c & 1 ) ) c++;
+			color[i] = c;
+			if( c < MAX_COLORS ) {
+				used[a[i]] |= 1ull<<c;
+				used[b[i]] |= 1ull<<c;
+			}
+			nColors = std::max( nColors, c+1 );
+		}
+		colorStart.assign( nColors+1, 0 );
+		for( int c: color ) colorStart[c+1]++;
+		for( int c=0; c<nColors; c++ ) colorStart[c+1] += colorStart[c];
+		std::vector<int> order( count() ), fill( colorStart.begin(), colorStart.end()-1 );
+		for( int i=0; i<count(); i++ ) order[fill[color[i]]++] = i;
+		permute( order );
+		buildAdjacency( nParticles );
+	}
+	int colors() const { return colorStart.empty() ? 0 : (int)colorStart.size()-1; }
+	// Moves spring order[i] to slot i.
+	void permute( const std::vector<int>& order ) {
+		auto apply = [&]( auto& v ) {
+			auto tmp = v;
+			for( size_t i=0; i<order.size(); i++ ) tmp[i] = v[order[i]];
+			v.swap( tmp );
+		};
+		apply( a ); apply( b );
+		apply( restLength ); apply( k ); apply( kd );
+	}
+
+	// Force on b; a gets its negative. One square root per spring.
+	glm::vec3 force( const Particles& p, int i ) const {
+		glm::vec3 dx = p.position(a[i]) - p.position(b[i]);
+		float len = sqrtf( dot(dx, dx) );
+		glm::vec3 dx_ = dx * (1/len);
+		glm::vec3 dv = p.velocity(a[i]) - p.velocity(b[i]);
+		return (k[i] * ( len - restLength[i]) + kd[i] * dot(dv, dx_)) * dx_;
+	}
+	void addForces( Particles& p, SpringEvaluation mode = SPRINGS_SERIAL ) const {
+		// fall back to the serial loop if springs were added since the tables were built
+		if( mode == SPRINGS_COLORED && colors() > 0 && colorStart.back() == count() ) {
+			for( int c=0; c<colors(); c++ ) {
+				if( c == MAX_COLORS )
+					scatter( p, colorStart[c], colorStart[c+1] );
+				else
+					parallelFor( colorStart[c], colorStart[c+1], [&]( int s, int e ) { scatter( p, s, e ); }, 2048 );
+			}
+		}
+		else if( mode == SPRINGS_GATHERED && (int)adjStart.size() == p.count+1 && adjStart.back() == 2*count() ) {
+			forces.resize( count() );
+			parallelFor( 0, count(), [&]( int s, int e ) {
+				for( int i=s; i<e; i++ ) forces[i] = force( p, i );
+			}, 2048 );
+			parallelFor( 0, p.count, [&]( int s, int e ) {
+				for( int j=s; j<e; j++ ) {
+					glm::vec3 f( 0 );
+					for( int n=adjStart[j]; n<adjStart[j+1]; n++ ) {
+						int i = adjSpring[n];
+						f += b[i] == j ? forces[i] : -forces[i];
+					}
+					p.addForce( j, f );
+				}
+			}, 1024 );
+		}
+		else
+			scatter( p, 0, count() );
+	}
+	void draw( const Particles& p ) const {
+		for( int i=0; i<count(); i++ )
+			drawCylinder( p.position(a[i]), p.position(b[i]), 0.4, glm::vec4(0,1,.4,1) );
+	}
+
+private:
+	void scatter( Particles& p, int s, int e ) const {
+		for( int i=s; i<e; i++ ) {
+			glm::vec3 f = force( p, i );
+			p.addForce( a[i], -f );
+			p.addForce( b[i], f );
+		}
+	}
+};
+
+// 10 bits of v spread to every third bit.
+static inline uint32_t mortonSpread( uint32_t v ) {
+	v = ( v | ( v<<16 ) ) & 0x030000FF;
+	v = ( v | ( v<< 8 ) ) & 0x0300F00F;
+	v = ( v | ( v<< 4 ) ) & 0x030C30C3;
+	v = ( v | ( v<< 2 ) ) & 0x09249249;
+	return v;
+}
+
+// Renumbers particles along the Morton curve of their current positions
+// and sorts springs by endpoints, then rebuilds the adjacency (call
+// Springs::buildColors() afterwards if needed). Returns
+// newIndex[oldIndex] for remapping other references to particles (pins,
+// mesh faces).
+static inline std::vector<int> reorderMorton( Particles& p, Springs& s ) {
+	std::vector<int> newIndex( p.count );
+	if( p.count == 0 ) return newIndex;
+	glm::vec3 lo = p.position(0), hi = lo;
+	for( int i=1; i<p.count; i++ ) {
+		lo = min( lo, p.position(i) );
+		hi = max( hi, p.position(i) );
+	}
+	// One scale for all axes: a flat cloth with a little noise across it
+	// must not spread that noise over the whole depth of the code.
+	glm::vec3 extent = hi-lo;
+	float scale = 1023.f/std::max( std::max( extent.x, extent.y ), std::max( extent.z, 1e-6f ) );
+	std::vector<uint32_t> code( p.count );
+	for( int i=0; i<p.count; i++ ) {
+		glm::uvec3 q = glm::uvec3( ( p.position(i)-lo )*scale );
+		code[i] = mortonSpread( q.x ) | ( mortonSpread( q.y )<<1 ) | ( mortonSpread( q.z )<<2 );
+	}
+	std::vector<int> order( p.count );
+	std::iota( order.begin(), order.end(), 0 );
+	std::stable_sort( order.begin(), order.end(), [&]( int i, int j ) { return code[i] < code[j]; } );
+	p.permute( order );
+	for( int i=0; i<p.count; i++ ) newIndex[order[i]] = i;
+
+	for( int i=0; i<s.count(); i++ ) {
+		s.a[i] = newIndex[s.a[i]];
+		s.b[i] = newIndex[s.b[i]];
+	}
+	std::vector<int> springOrder( s.count() );
+	std::iota( springOrder.begin(), springOrder.end(), 0 );
+	auto key = [&]( int i ) { return std::make_pair( std::min( s.a[i], s.b[i] ), std::max( s.a[i], s.b[i] ) ); };
+	std::sort( springOrder.begin(), springOrder.end(), [&]( int i, int j ) { return key(i) < key(j); } );
+	s.permute( springOrder );
+	s.colorStart.clear();
+	s.buildAdjacency( p.count );
+	return newIndex;
+}
+
+// The collision response of all colliders: a particle within eps of the
+// surface (d is its signed distance along the outward normal N) is put
+// back on it, loses its approaching normal velocity times alpha when that
+// is above eps, and all of it when it is smaller.
+static inline void resolveContact( glm::vec3& x, glm::vec3& vel, const glm::vec3& N, float d, float alpha, float eps ) {
+	if (d < eps) {
+		float v = dot(N, vel);
+		if (v < -eps) {
+			glm::vec3 vN = v * N;
+			glm::vec3 vT = vel - vN;
+			vel = vT - alpha * vN;
+		} else if (v < eps) {
+			glm::vec3 vN = v * N;
+			glm::vec3 vT = vel - vN;
+			vel = vT;
+		}
+		x += -d * N;
+	}
+}
+
+// The discrete pass of a collider that tests one particle at a time:
+// resolve(x, v) on every movable particle, by blocks of `grain` on the
+// Parallel.hpp pool. Returns the particles it changed.
+template<typename Resolve>
+static inline int resolveParticles( Particles& p, int grain, Resolve resolve ) {
+	std::atomic<int> changed{ 0 };
+	parallelFor( 0, p.count, [&]( int b, int e ) {
+		int found = 0;
+		for( int i=b; i<e; i++ ) {
+			if( p.invMass[i] == 0 ) continue;
+			glm::vec3 x0 = p.position(i), v0 = p.velocity(i), x = x0, v = v0;
+			resolve( x, v );
+			if( x == x0 && v == v0 ) continue;
+			p.setPosition( i, x );
+			p.setVelocity( i, v );
+			found++;
+		}
+		changed += found;
+	}, grain );
+	return changed;
+}
+
+// The earliest contact on a particle's path x0-x1 over a substep, for the
+// colliders' sweep(), which only report paths that enter from outside.
+// apply() stops the particle there and gives it the collision response, so
+// it cannot tunnel through a collider thinner than one substep's motion;
+// the rest of the motion continues along the surface, so that resting
+// particles slide as with resolveCollision().
+struct SweepHit {
+	float t = 2;			// time of impact in [0,1], above 1 for none
+	glm::vec3 N = glm::vec3( 0 );
+	float alpha = 0, eps = 0;
+
+	void consider( float toi, const glm::vec3& normal, float a, float e ) {
+		if( toi < 0 || toi >= t ) return;
+		t = toi;
+		N = normal;
+		alpha = a;
+		eps = e;
+	}
+	bool apply( const glm::vec3& x0, glm::vec3& x, glm::vec3& vel ) const {
+		if( t > 1 ) return false;
+		glm::vec3 rest = ( 1-t )*( x-x0 );
+		x = x0 + t*( x-x0 ) + rest - dot( rest, N )*N;
+		resolveContact( x, vel, N, 0, alpha, eps );
+		return true;
+	}
+};
+
+struct Plane {
+	glm::vec3 N;
+	glm::vec3 p;
+	float alpha = 0.6;
+	Plane( const glm::vec3& position, const glm::vec3& normal ): N(normal), p(position){}
+	void draw() const {
+		drawQuad(p,N,{1000,1000},glm::vec4(0,0,1,1));
+	}
+	static constexpr float eps = 0.0001;
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		resolveContact( x, vel, N, dot(N, x - p), alpha, eps );
+	}
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		float d0 = dot(N, x0 - p), d1 = dot(N, x1 - p);
+		if (d0 >= 0 && d1 < 0) hit.consider( d0 / (d0 - d1), N, alpha, eps );
+	}
+};
+
+struct Sphere {
+	glm::vec3 p;
+	float radius;
+	float alpha = 0.6;
+	Sphere(const glm::vec3& position,const float& r) : p(position), radius(r) {}
+	void draw() const {
+		drawSphere(p, radius, glm::vec4(1, 1, 0, alpha));
+	}
+	static constexpr float eps = 0.01;
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		glm::vec3 N = normalize(x - p);
+		resolveContact( x, vel, N, dot(N, x - p) - radius, alpha, eps );
+	}
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		glm::vec3 s = x1 - x0, m = x0 - p;
+		float a = dot(s, s), b = dot(m, s), c = dot(m, m) - radius*radius;
+		float disc = b*b - a*c;
+		if (c < 0 || b >= 0 || disc < 0 || a == 0) return;		// inside, leaving or missing
+		float t = (-b - sqrtf(disc)) / a;
+		if (t <= 1) hit.consider( t, normalize(x0 + t*s - p), alpha, eps );
+	}
+};
+
+// A cylinder with hemispherical caps: the points within radius of the
+// segment a-b.
+struct Capsule {
+	glm::vec3 a, b;
+	float radius;
+	float alpha = 0.6;
+	static constexpr float eps = 0.01;
+	Capsule( const glm::vec3& end0, const glm::vec3& end1, float r ) : a(end0), b(end1), radius(r) {}
+	void draw() const {
+		drawCylinder(a, b, radius, glm::vec4(1, .6, 0, 1));
+		drawSphere(a, radius, glm::vec4(1, .6, 0, 1));
+		drawSphere(b, radius, glm::vec4(1, .6, 0, 1));
+	}
+	glm::vec3 closestPoint( const glm::vec3& x ) const {
+		glm::vec3 ab = b - a;
+		float t = glm::clamp( dot(x - a, ab)/std::max( dot(ab, ab), 1e-12f ), 0.f, 1.f );
+		return a + t*ab;
+	}
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		glm::vec3 c = closestPoint( x );
+		glm::vec3 N = normalize(x - c);
+		resolveContact( x, vel, N, dot(N, x - c) - radius, alpha, eps );
+	}
+	// the cylinder, then the sphere of the nearer cap (Quilez)
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		glm::vec3 c0 = closestPoint( x0 );
+		if (dot(x0 - c0, x0 - c0) < radius*radius) return;
+		glm::vec3 s = x1 - x0, ba = b - a, oa = x0 - a;
+		float baba = dot(ba, ba), bas = dot(ba, s), baoa = dot(ba, oa), ss = dot(s, s);
+		float A = baba*ss - bas*bas, B = baba*dot(s, oa) - baoa*bas, C = baba*dot(oa, oa) - baoa*baoa - radius*radius*baba;
+		float t = -1, y = baoa;
+		if (A > 1e-12f) {		// else parallel to the axis: only the caps
+			if (B*B - A*C < 0) return;
+			t = (-B - sqrtf(B*B - A*C)) / A;
+			y = baoa + t*bas;
+		}
+		if (A <= 1e-12f || y <= 0 || y >= baba) {
+			glm::vec3 oc = y <= 0 ? oa : x0 - b;
+			float bc = dot(s, oc), cc = dot(oc, oc) - radius*radius;
+			t = bc*bc - ss*cc >= 0 && ss > 0 ? (-bc - sqrtf(bc*bc - ss*cc)) / ss : -1;
+		}
+		if (t < 0 || t > 1) return;
+		glm::vec3 x = x0 + t*s;
+		glm::vec3 N = x - closestPoint( x );
+		float len = length( N );
+		if (len > 0) hit.consider( t, N / len, alpha, eps );
+	}
+};
+
+// Axis-aligned. A particle inside, or within eps of a face, leaves through
+// the nearest face.
+struct Box {
+	glm::vec3 center, halfSize;
+	float alpha = 0.6;
+	static constexpr float eps = 0.01;
+	Box( const glm::vec3& c, const glm::vec3& h ) : center(c), halfSize(h) {}
+	void draw() const {
+		const glm::vec4 color(.6, .6, .7, 1);
+		const glm::vec3& h = halfSize;
+		for( float s: { -1.f, 1.f } ) {
+			drawQuad( center+glm::vec3(s*h.x, 0, 0), {s, 0, 0}, {h.z, h.y}, color );
+			drawQuad( center+glm::vec3(0, s*h.y, 0), {0, s, 0}, {h.x, h.z}, color );
+			drawQuad( center+glm::vec3(0, 0, s*h.z), {0, 0, s}, {h.x, h.y}, color );
+		}
+	}
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		glm::vec3 q = x - center;
+		int axis = 0;
+		float d = -1e30f;		// distance outside the nearest face, negative inside
+		for( int i=0; i<3; i++ ) {
+			float di = fabsf( q[i] ) - halfSize[i];
+			if( di >= eps ) return;
+			if( di > d ) {
+				d = di;
+				axis = i;
+			}
+		}
+		glm::vec3 N( 0 );
+		N[axis] = q[axis] < 0 ? -1.f : 1.f;
+		resolveContact( x, vel, N, d, alpha, eps );
+	}
+	// slabs: the last face entered, if before any is left
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		glm::vec3 q = x0 - center, s = x1 - x0;
+		float tEnter = -1, tExit = 1;
+		int axis = -1;
+		for( int i=0; i<3; i++ ) {
+			if( s[i] == 0 ) {
+				if( fabsf( q[i] ) > halfSize[i] ) return;
+				continue;
+			}
+			float ta = ( -halfSize[i] - q[i] )/s[i], tb = ( halfSize[i] - q[i] )/s[i];
+			if( ta > tb ) std::swap( ta, tb );
+			if( ta > tEnter ) {
+				tEnter = ta;
+				axis = i;
+			}
+			tExit = std::min( tExit, tb );
+		}
+		if( axis < 0 || tEnter < 0 || tEnter > tExit ) return;		// starts inside, or misses
+		glm::vec3 N( 0 );
+		N[axis] = s[axis] > 0 ? -1.f : 1.f;
+		hit.consider( tEnter, N, alpha, eps );
+	}
+};
+
+#endif /* Cloth_hpp */
@@ -0,0 +1,301 @@
+//
+//  Colliders.hpp
+//  SpringMass
+//
+//  A scene of many obstacles for the cloth. Planes are unbounded and tested
+//  by every particle; spheres, capsules and boxes are entered by their
+//  bounding boxes into a uniform grid (build() after changing them), so a
+//  particle only meets the colliders of the cell it is in.
+//  resolve() runs over the particles in SIMD_PAD blocks on the Parallel.hpp
+//  pool: a block gathers the colliders of the cells its bounding box
+//  overlaps, tests all its lanes against each with one SIMD distance
+//  bound, and calls the exact resolveCollision() only on the lanes that
+//  may touch. Blocks away from every obstacle cost one grid lookup, so the
+//  work follows the contacts, not particles times colliders.
+//  resolveCollision() is the same for one particle, for the integrators
+//  that take a per-particle callback.
+//  sweep() finds where a particle's path over a substep first enters a
+//  collider, among the planes and the colliders of the cells its bounding
+//  box overlaps; sweepParticles() runs such a test for every particle
+//  after integrate() and stops it at that contact.
+//
+
+#ifndef Colliders_hpp
+#define Colliders_hpp
+
+#include "Cloth.hpp"
+
+struct ColliderSet {
+	std::vector<Plane> planes;
+	std::vector<Sphere> spheres;
+	std::vector<Capsule> capsules;
+	std::vector<Box> boxes;
+	float margin = 0.05f;		// widens the SIMD bounds beyond the exact tests
+	// of the last resolve()
+	int tests = 0;				// block-collider pairs tested
+	int contacts = 0;			// particle-collider pairs that reached the exact test
+
+	void clear() {
+		planes.clear();
+		spheres.clear();
+		capsules.clear();
+		boxes.clear();
+		build();
+	}
+	void draw() const {
+		for( auto& c: planes ) c.draw();
+		for( auto& c: spheres ) c.draw();
+		for( auto& c: capsules ) c.draw();
+		for( auto& c: boxes ) c.draw();
+	}
+
+	// Grid of about eight cells per bounded collider, at most 128 a side.
+	void build() {
+		std::vector<std::pair<glm::vec3, glm::vec3>> bounds;
+		refs.clear();
+		for( int i=0; i<(int)spheres.size(); i++ ) {
+			glm::vec3 r( spheres[i].radius + Sphere::eps + margin );
+			bounds.push_back( { spheres[i].p - r, spheres[i].p + r } );
+			refs.push_back( ref( SPHERE, i ) );
+		}
+		for( int i=0; i<(int)capsules.size(); i++ ) {
+			glm::vec3 r( capsules[i].radius + Capsule::eps + margin );
+			bounds.push_back( { min( capsules[i].a, capsules[i].b ) - r, max( capsules[i].a, capsules[i].b ) + r } );
+			refs.push_back( ref( CAPSULE, i ) );
+		}
+		for( int i=0; i<(int)boxes.size(); i++ ) {
+			glm::vec3 r = boxes[i].halfSize + glm::vec3( Box::eps + margin );
+			bounds.push_back( { boxes[i].center - r, boxes[i].center + r } );
+			refs.push_back( ref( BOX, i ) );
+		}
+		cellStart.assign( 1, 0 );
+		cellItems.clear();
+		dims = glm::ivec3( 0 );
+		if( bounds.empty() ) return;
+		lo = bounds[0].first;
+		hi = bounds[0].second;
+		for( auto& b: bounds ) {
+			lo = min( lo, b.first );
+			hi = max( hi, b.second );
+		}
+		glm::vec3 extent = glm::max( hi-lo, glm::vec3( 1e-3f ) );
+		float cell = cbrtf( extent.x*extent.y*extent.z/( 8.f*bounds.size() ) );
+		for( int k=0; k<3; k++ ) dims[k] = std::clamp( (int)ceilf( extent[k]/cell ), 1, 128 );
+		invCell = glm::vec3( dims )/extent;
+
+		std::vector<int> count( dims.x*dims.y*dims.z+1, 0 );
+		auto forCells = [&]( const std::pair<glm::vec3, glm::vec3>& b, auto f ) {
+			glm::ivec3 c0 = cellOf( b.first ), c1 = cellOf( b.second );
+			for( int z=c0.z; z<=c1.z; z++ ) for( int y=c0.y; y<=c1.y; y++ ) for( int x=c0.x; x<=c1.x; x++ )
+				f( ( z*dims.y + y )*dims.x + x );
+		};
+		for( auto& b: bounds ) forCells( b, [&]( int c ) { count[c+1]++; } );
+		for( size_t c=1; c<count.size(); c++ ) count[c] += count[c-1];
+		cellStart = count;
+		cellItems.resize( cellStart.back() );
+		for( size_t i=0; i<bounds.size(); i++ )
+			forCells( bounds[i], [&]( int c ) { cellItems[count[c]++] = (int)i; } );
+	}
+
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		for( auto& c: planes ) c.resolveCollision( x, vel );
+		resolveBounded( x, vel );
+	}
+
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		for( auto& c: planes ) c.sweep( x0, x1, hit );
+		if( cellItems.empty() ) return;
+		glm::vec3 a = min( x0, x1 ), b = max( x0, x1 );
+		if( !inside( a, b ) ) return;
+		glm::ivec3 c0 = cellOf( a ), c1 = cellOf( b );
+		if( ( c1.x-c0.x+1 )*( c1.y-c0.y+1 )*( c1.z-c0.z+1 ) > (int)refs.size() ) {
+			for( int r: refs ) sweepOne( r, x0, x1, hit );		// a long path: every collider once
+			return;
+		}
+		for( int z=c0.z; z<=c1.z; z++ ) for( int y=c0.y; y<=c1.y; y++ ) for( int x=c0.x; x<=c1.x; x++ ) {
+			int cell = ( z*dims.y + y )*dims.x + x;
+			for( int k=cellStart[cell]; k<cellStart[cell+1]; k++ )
+				sweepOne( refs[cellItems[k]], x0, x1, hit );
+		}
+	}
+
+	void resolve( Particles& p ) {
+		const int nBlocks = ( p.count+SIMD_PAD-1 )/SIMD_PAD, grain = 64;
+		blockTests.assign( ( nBlocks+grain-1 )/grain, 0 );
+		blockContacts.assign( blockTests.size(), 0 );
+		parallelFor( 0, nBlocks, [&]( int b, int e ) {
+			int nTests = 0, nContacts = 0;
+			for( int block=b; block<e; block++ )
+				resolveBlock( p, block*SIMD_PAD, std::min( block*SIMD_PAD+SIMD_PAD, p.count ), nTests, nContacts );
+			blockTests[b/grain] = nTests;
+			blockContacts[b/grain] = nContacts;
+		}, grain );
+		tests = contacts = 0;
+		for( size_t i=0; i<blockTests.size(); i++ ) {
+			tests += blockTests[i];
+			contacts += blockContacts[i];
+		}
+	}
+
+private:
+	enum Kind { PLANE, SPHERE, CAPSULE, BOX };
+	static int ref( Kind kind, int index ) { return index<<2 | kind; }
+
+	std::vector<int> refs;					// bounded colliders in build() order
+	std::vector<int> cellStart, cellItems;	// indices into refs, per cell
+	glm::ivec3 dims = glm::ivec3( 0 );
+	glm::vec3 lo = glm::vec3( 0 ), hi = glm::vec3( 0 ), invCell = glm::vec3( 0 );
+	std::vector<int> blockTests, blockContacts;
+
+	glm::ivec3 cellOf( const glm::vec3& x ) const {
+		glm::ivec3 c = glm::ivec3( ( x-lo )*invCell );
+		return glm::clamp( c, glm::ivec3( 0 ), dims-glm::ivec3( 1 ) );
+	}
+	void resolveBounded( glm::vec3& x, glm::vec3& vel ) const {
+		if( cellItems.empty() || !inside( x, x ) ) return;
+		glm::ivec3 c = cellOf( x );
+		int cell = ( c.z*dims.y + c.y )*dims.x + c.x;
+		for( int k=cellStart[cell]; k<cellStart[cell+1]; k++ )
+			resolveOne( refs[cellItems[k]], x, vel );
+	}
+	// whether the box [a,b] overlaps the grid
+	bool inside( const glm::vec3& a, const glm::vec3& b ) const {
+		return b.x >= lo.x && b.y >= lo.y && b.z >= lo.z && a.x <= hi.x && a.y <= hi.y && a.z <= hi.z;
+	}
+	void resolveOne( int r, glm::vec3& x, glm::vec3& vel ) const {
+		switch( r & 3 ) {
+			case PLANE:		planes[r>>2].resolveCollision( x, vel ); break;
+			case SPHERE:	spheres[r>>2].resolveCollision( x, vel ); break;
+			case CAPSULE:	capsules[r>>2].resolveCollision( x, vel ); break;
+			case BOX:		boxes[r>>2].resolveCollision( x, vel ); break;
+		}
+	}
+
+	void sweepOne( int r, const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		switch( r & 3 ) {
+			case PLANE:		planes[r>>2].sweep( x0, x1, hit ); break;
+			case SPHERE:	spheres[r>>2].sweep( x0, x1, hit ); break;
+			case CAPSULE:	capsules[r>>2].sweep( x0, x1, hit ); break;
+			case BOX:		boxes[r>>2].sweep( x0, x1, hit ); break;
+		}
+	}
+
+	// Lanes of particles [i, i+WIDTH) that may be within reach of collider r.
+	int candidates( int r, const Particles& p, int i ) const {
+		const SimdFloat x = SimdFloat::load( &p.px[i] ), y = SimdFloat::load( &p.py[i] ), z = SimdFloat::load( &p.pz[i] );
+		const SimdFloat zero( 0.f );
+		switch( r & 3 ) {
+			case PLANE: {
+				const Plane& c = planes[r>>2];
+				SimdFloat d = ( x - SimdFloat( c.p.x ) )*SimdFloat( c.N.x ) + ( y - SimdFloat( c.p.y ) )*SimdFloat( c.N.y )
+					+ ( z - SimdFloat( c.p.z ) )*SimdFloat( c.N.z );
+				return lessMask( d, SimdFloat( Plane::eps + margin ) );
+			}
+			case SPHERE: {
+				const Sphere& c = spheres[r>>2];
+				SimdFloat dx = x - SimdFloat( c.p.x ), dy = y - SimdFloat( c.p.y ), dz = z - SimdFloat( c.p.z );
+				float reach = c.radius + Sphere::eps + margin;
+				return lessMask( dx*dx + dy*dy + dz*dz, SimdFloat( reach*reach ) );
+			}
+			case CAPSULE: {
+				const Capsule& c = capsules[r>>2];
+				glm::vec3 ab = c.b - c.a;
+				float inv = 1/std::max( dot( ab, ab ), 1e-12f );
+				SimdFloat qx = x - SimdFloat( c.a.x ), qy = y - SimdFloat( c.a.y ), qz = z - SimdFloat( c.a.z );
+				SimdFloat t = ( qx*SimdFloat( ab.x ) + qy*SimdFloat( ab.y ) + qz*SimdFloat( ab.z ) )*SimdFloat( inv );
+				t = min( max( t, zero ), SimdFloat( 1.f ) );
+				SimdFloat dx = qx - t*SimdFloat( ab.x ), dy = qy - t*SimdFloat( ab.y ), dz = qz - t*SimdFloat( ab.z );
+				float reach = c.radius + Capsule::eps + margin;
+				return lessMask( dx*dx + dy*dy + dz*dz, SimdFloat( reach*reach ) );
+			}
+			case BOX: {
+				const Box& c = boxes[r>>2];
+				SimdFloat dx = x - SimdFloat( c.center.x ), dy = y - SimdFloat( c.center.y ), dz = z - SimdFloat( c.center.z );
+				// largest of |q_i| - h_i
+				SimdFloat d = max( max( max( dx, zero-dx ) - SimdFloat( c.halfSize.x ), max( dy, zero-dy ) - SimdFloat( c.halfSize.y ) ),
+					max( dz, zero-dz ) - SimdFloat( c.halfSize.z ) );
+				return lessMask( d, SimdFloat( Box::eps + margin ) );
+			}
+		}
+		return 0;
+	}
+
+	// Lanes that may touch r go through its exact test.
+	void resolveLanes( Particles& p, int r, int begin, int end, int& nContacts ) const {
+		for( int i=begin; i<begin+SIMD_PAD; i+=SimdFloat::WIDTH ) {
+			int mask = candidates( r, p, i );
+			for( int lane=0; mask; lane++, mask>>=1 ) {
+				if( !( mask&1 ) || i+lane >= end ) continue;
+				glm::vec3 x = p.position(i+lane), v = p.velocity(i+lane);
+				resolveOne( r, x, v );
+				p.setPosition( i+lane, x );
+				p.setVelocity( i+lane, v );
+				nContacts++;
+			}
+		}
+	}
+	void resolveBlock( Particles& p, int begin, int end, int& nTests, int& nContacts ) const {
+		for( int i=0; i<(int)planes.size(); i++ ) {
+			nTests++;
+			resolveLanes( p, ref( PLANE, i ), begin, end, nContacts );
+		}
+		if( cellItems.empty() ) return;
+		glm::vec3 a = p.position(begin), b = a;
+		for( int i=begin+1; i<end; i++ ) {
+			a = min( a, p.position(i) );
+			b = max( b, p.position(i) );
+		}
+		if( !inside( a, b ) ) return;
+		// the colliders of the cells the block overlaps, in build() order like resolveCollision()
+		const int MAX_FOUND = 64;
+		int found[MAX_FOUND], nFound = 0;
+		glm::ivec3 c0 = cellOf( a ), c1 = cellOf( b );
+		for( int z=c0.z; z<=c1.z; z++ ) for( int y=c0.y; y<=c1.y; y++ ) for( int x=c0.x; x<=c1.x; x++ ) {
+			int cell = ( z*dims.y + y )*dims.x + x;
+			for( int k=cellStart[cell]; k<cellStart[cell+1]; k++ ) {
+				if( std::find( found, found+nFound, cellItems[k] ) != found+nFound ) continue;
+				if( nFound == MAX_FOUND ) {		// too crowded: one particle at a time
+					for( int i=begin; i<end; i++ ) {
+						glm::vec3 xi = p.position(i), vi = p.velocity(i);
+						resolveBounded( xi, vi );
+						p.setPosition( i, xi );
+						p.setVelocity( i, vi );
+					}
+					nTests += nFound;
+					return;
+				}
+				found[nFound++] = cellItems[k];
+			}
+		}
+		std::sort( found, found+nFound );
+		for( int f=0; f<nFound; f++ ) {
+			nTests++;
+			resolveLanes( p, refs[found[f]], begin, end, nContacts );
+		}
+	}
+};
+
+// Continuous collisions after Particles::integrate() over a substep of
+// length h: each particle's path starts at x - h v, and
+// sweep(x0, x1, hit) collects the contacts on it from any colliders.
+// Returns the particles stopped.
+template<typename Sweep>
+static inline int sweepParticles( Particles& p, float h, Sweep sweep ) {
+	std::atomic<int> stopped{ 0 };
+	parallelFor( 0, p.count, [&]( int b, int e ) {
+		int found = 0;
+		for( int i=b; i<e; i++ ) {
+			glm::vec3 x = p.position(i), v = p.velocity(i), x0 = x - h*v;
+			SweepHit hit;
+			sweep( x0, x, hit );
+			if( !hit.apply( x0, x, v ) ) continue;
+			p.setPosition( i, x );
+			p.setVelocity( i, v );
+			found++;
+		}
+		stopped += found;
+	}, 1024 );
+	return stopped;
+}
+
+#endif /* Colliders_hpp */
@@ -0,0 +1,185 @@
+//
+//  Headless.hpp
+//  SpringMass
+//
+//  Windowless batch rendering: an AnimView is driven with a fixed time step
+//  inside an offscreen EGL context (works on GPU-less Linux through Mesa
+//  llvmpipe) and every frame is captured (FrameCapture.hpp) either as a raw
+//  Y4M stream or as a numbered PPM sequence. A frames-per-second report goes
+//  to stderr.
+//
+//  usage: app --headless [--frames N] [--dt S | --fps F] [--size WxH]
+//             [--out out.y4m | - | frame%05d.ppm]
+//
+//  A Y4M stream can be piped straight into an encoder:
+//    app --headless --out - | ffmpeg -i - clip.mp4
+//
+
+#ifndef Headless_hpp
+#define Headless_hpp
+
+#include "AnimView.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#if __has_include(<EGL/egl.h>)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define HEADLESS_HAS_EGL
+#endif
+
+struct HeadlessOptions {
+	int width = 640;
+	int height = 480;
+	int frames = 300;
+	float dt = 1/60.f;
+	std::string output = "out.y4m";	// *.y4m or "-": Y4M stream, otherwise a printf pattern for PPM files
+
+	// Returns true if --headless is on the command line; other arguments are left to the caller.
+	bool parse( int argc, const char* argv[] ) {
+		bool headless = false;
+		for( int i=1; i<argc; i++ ) {
+			std::string a = argv[i];
+			bool hasValue = i+1<argc;
+			if( a == "--headless" ) headless = true;
+			else if( a == "--frames" && hasValue ) frames = atoi( argv[++i] );
+			else if( a == "--dt" && hasValue ) dt = (float)atof( argv[++i] );
+			else if( a == "--fps" && hasValue ) dt = 1.f/(float)atof( argv[++i] );
+			else if( a == "--out" && hasValue ) output = argv[++i];
+			else if( a == "--size" && hasValue ) sscanf( argv[++i], "%dx%d", &width, &height );
+		}
+		if( headless )
+			AsyncLoader::wakeEventLoop = false;	// no GLFW event loop to wake
+		if( headless && output == "-" )
+			FrameSink::streamStdout();
+		return headless;
+	}
+};
+
+#ifdef HEADLESS_HAS_EGL
+struct HeadlessContext {
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	EGLSurface surface = EGL_NO_SURFACE;
+
+	// Prefers a surfaceless display (no X/Wayland needed); falls back to the
+	// default display with a 1x1 pbuffer. All rendering goes to FBOs anyway.
+	bool create() {
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+		if( getPlatformDisplay )
+			display = getPlatformDisplay( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr );
+#endif
+		if( display == EGL_NO_DISPLAY || !eglInitialize( display, nullptr, nullptr ) ) {
+			display = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+			if( display == EGL_NO_DISPLAY || !eglInitialize( display, nullptr, nullptr ) ) {
+				std::cerr<<"[ERROR] Headless: no EGL display\n";
+				return false;
+			}
+		}
+		const EGLint configAttr[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config = nullptr;
+		EGLint nConfigs = 0;
+		eglChooseConfig( display, configAttr, &config, 1, &nConfigs );
+		eglBindAPI( EGL_OPENGL_API );
+		const EGLint contextAttr[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 1,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+		context = eglCreateContext( display, nConfigs ? config : nullptr, EGL_NO_CONTEXT, contextAttr );
+		if( context == EGL_NO_CONTEXT ) {
+			std::cerr<<"[ERROR] Headless: could not create a GL 4.1 core context ("<<std::hex<<eglGetError()<<std::dec<<")\n";
+			return false;
+		}
+		if( !eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, context ) && nConfigs ) {
+			const EGLint pbufferAttr[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+			surface = eglCreatePbufferSurface( display, config, pbufferAttr );
+			eglMakeCurrent( display, surface, surface, context );
+		}
+		if( eglGetCurrentContext() != context ) {
+			std::cerr<<"[ERROR] Headless: could not make the context current\n";
+			return false;
+		}
+		return true;
+	}
+	~HeadlessContext() {
+		if( display == EGL_NO_DISPLAY ) return;
+		eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+		if( surface != EGL_NO_SURFACE ) eglDestroySurface( display, surface );
+		if( context != EGL_NO_CONTEXT ) eglDestroyContext( display, context );
+		eglTerminate( display );
+	}
+};
+#endif
+
+// Renders opt.frames frames of `view` offscreen; returns a process exit code.
+static inline int runHeadless( AnimView& view, const HeadlessOptions& opt ) {
+#ifndef HEADLESS_HAS_EGL
+	std::cerr<<"[ERROR] Headless mode needs EGL, which is not available on this platform\n";
+	return 1;
+#else
+	typedef std::chrono::steady_clock Clock;
+	auto ms = []( Clock::time_point a, Clock::time_point b ) { return std::chrono::duration<double,std::milli>( b-a ).count(); };
+
+	HeadlessContext ctx;
+	if( !ctx.create() ) return 1;
+	FB target;
+	target.create( opt.width, opt.height );
+
+	auto drawFrame = [&]() {
+		target.setToTarget();
+		view.drawGL();
+		target.restoreVP();
+	};
+	// Shaders and clips load asynchronously; draw until both have landed.
+	// Shaders get a few seconds; a large clip takes as long as it takes, as
+	// rendering without it would silently capture an empty scene, and a
+	// clip that fails to load fails the run.
+	auto waitStart = Clock::now();
+	while( view.renderProg==0 || AsyncLoader::busy() ) {
+		if( view.renderProg==0 && ms( waitStart, Clock::now() )>5000 ) {
+			std::cerr<<"[ERROR] Headless: shaders did not load\n";
+			return 1;
+		}
+		if( AsyncLoader::failed() ) break;
+		drawFrame();
+		std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+		AsyncLoader::pumpGL();
+	}
+	if( AsyncLoader::failed() ) {
+		std::cerr<<"[ERROR] Headless: an asset failed to load\n";
+		return 1;
+	}
+
+	// Frames are read back through the view's PBO ring and written on its
+	// writer thread, so this loop only pays for simulation and GL submission.
+	view.captureOutput = opt.output;
+	view.captureFps = 1/opt.dt;
+	double simMs = 0, renderMs = 0;
+	auto start = Clock::now();
+	int frame = 0;
+	for( ; frame<opt.frames && !view.frameCapture.failed; frame++ ) {
+		auto t0 = Clock::now();
+		view.step( opt.dt );
+		auto t1 = Clock::now();
+		drawFrame();
+		auto t2 = Clock::now();
+		simMs += ms( t0, t1 );
+		renderMs += ms( t1, t2 );
+	}
+	auto t3 = Clock::now();
+	view.stopCapture();
+	double flushMs = ms( t3, Clock::now() );
+	double totalMs = ms( start, Clock::now() );
+	target.clearGL();
+
+	int n = frame>0 ? frame : 1;
+	fprintf( stderr, "headless: %d frames %dx%d in %.2f s = %.1f fps (per frame: sim %.2f ms, render+capture %.2f ms; final flush %.1f ms)\n",
+			frame, opt.width, opt.height, totalMs/1000, frame*1000/totalMs, simMs/n, renderMs/n, flushMs );
+	return frame==opt.frames && !view.frameCapture.failed ? 0 : 1;
+#endif
+}
+
+#endif /* Headless_hpp */
@@ -0,0 +1,424 @@
+//
+//  MeshCollider.hpp
+//  SpringMass
+//
+//  Triangle meshes as colliders, for draping cloth over characters and
+//  props. TriangleMesh reads the vertices and faces of an OBJ file
+//  (polygons are fanned into triangles). TriangleBvh puts the triangles in
+//  a bounding volume hierarchy built top-down with the surface area
+//  heuristic over 16 bins of centroids, leaves of at most four triangles
+//  (more only at the depth limit of the traversal stacks), and answers
+//  closest-point queries within a radius, nearer child first.
+//  Each triangle keeps the angle-weighted pseudonormals of its vertices
+//  and edges (Baerentzen & Aanaes 2005), so the side of a point is right
+//  even when its closest point is on an edge or a corner.
+//  MeshCollider places a mesh by a rigid transform, which may change every
+//  frame, and resolves particles like Sphere::resolveCollision(): those
+//  closer than `thickness` in front of the surface, or less than `depth`
+//  behind it, are put back on the thickened surface and lose their
+//  approaching velocity relative to the mesh times alpha. resolve() covers
+//  all particles of a substep on the Parallel.hpp pool. sweep() casts a
+//  particle's path over a substep through the BVH and stops it where it
+//  crosses a triangle from the front. The mesh should be closed and wound
+//  counter-clockwise seen from outside.
+//
+
+#ifndef MeshCollider_hpp
+#define MeshCollider_hpp
+
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include "Cloth.hpp"
+
+struct TriangleMesh {
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::uvec3> faces;
+
+	void clear() {
+		vertices.clear();
+		faces.clear();
+	}
+	// "v" and "f" lines; texture and normal indices are skipped, negative
+	// indices count from the last vertex.
+	bool loadObj( const std::string& fn ) {
+		clear();
+		FILE* f = fopen( fn.c_str(), "r" );
+		if( !f ) {
+			std::cerr<<"[ERROR] Cannot open "<<fn<<std::endl;
+			return false;
+		}
+		char line[4096];
+		std::vector<int> polygon;
+		while( fgets( line, sizeof(line), f ) ) {
+			if( line[0] == 'v' && line[1] == ' ' ) {
+				glm::vec3 v( 0 );
+				sscanf( line+2, "%f %f %f", &v.x, &v.y, &v.z );
+				vertices.push_back( v );
+			}
+			else if( line[0] == 'f' && line[1] == ' ' ) {
+				polygon.clear();
+				std::istringstream ss( line+2 );
+				std::string corner;
+				while( ss >> corner ) {
+					int i = atoi( corner.c_str() );
+					polygon.push_back( i < 0 ? (int)vertices.size()+i : i-1 );
+				}
+				for( size_t k=2; k<polygon.size(); k++ )
+					faces.push_back( glm::uvec3( polygon[0], polygon[k-1], polygon[k] ) );
+			}
+		}
+		fclose( f );
+		for( auto& t: faces )
+			if( t.x >= vertices.size() || t.y >= vertices.size() || t.z >= vertices.size() ) {
+				std::cerr<<"[ERROR] Face index out of range in "<<fn<<std::endl;
+				clear();
+				return false;
+			}
+		return true;
+	}
+};
+
+struct TriangleBvh {
+	struct Node {
+		glm::vec3 lo, hi;
+		int start;			// first triangle of a leaf, or the first of two adjacent children
+		int count;			// triangles of a leaf, 0 for an inner node
+	};
+	std::vector<Node> nodes;
+	std::vector<glm::vec3> corners;			// three per triangle, in leaf order
+	// pseudonormals per triangle, in leaf order: the face, vertices 0-2, edges 01, 12, 20
+	std::vector<std::array<glm::vec3, 7>> normals;
+	// Nodes this deep stay leaves, however many triangles they hold, so that
+	// a traversal never has more than MAX_DEPTH+1 nodes on its stack.
+	static const int MAX_DEPTH = 63;
+
+	bool empty() const { return nodes.empty(); }
+
+	void build( const TriangleMesh& mesh ) {
+		const int n = (int)mesh.faces.size();
+		nodes.clear();
+		corners.clear();
+		normals.clear();
+		if( n == 0 ) return;
+		std::vector<glm::vec3> lo( n ), hi( n ), centroid( n );
+		for( int i=0; i<n; i++ ) {
+			const glm::uvec3& t = mesh.faces[i];
+			const glm::vec3 &a = mesh.vertices[t.x], &b = mesh.vertices[t.y], &c = mesh.vertices[t.z];
+			lo[i] = min( min( a, b ), c );
+			hi[i] = max( max( a, b ), c );
+			centroid[i] = ( a+b+c )/3.f;
+		}
+		std::vector<int> order( n );
+		std::iota( order.begin(), order.end(), 0 );
+		nodes.reserve( 2*n );
+		nodes.push_back( { glm::vec3( 0 ), glm::vec3( 0 ), 0, n } );
+		std::vector<std::pair<int, int>> stack = { { 0, 0 } };		// node, depth
+		while( !stack.empty() ) {
+			auto [node, depth] = stack.back();
+			stack.pop_back();
+			int start = nodes[node].start, count = nodes[node].count;
+			glm::vec3 bLo = lo[order[start]], bHi = hi[order[start]];
+			glm::vec3 cLo = centroid[order[start]], cHi = cLo;
+			for( int k=start+1; k<start+count; k++ ) {
+				bLo = min( bLo, lo[order[k]] );
+				bHi = max( bHi, hi[order[k]] );
+				cLo = min( cLo, centroid[order[k]] );
+				cHi = max( cHi, centroid[order[k]] );
+			}
+			nodes[node].lo = bLo;
+			nodes[node].hi = bHi;
+			int mid = depth < MAX_DEPTH ? split( order, lo, hi, centroid, start, count, cLo, cHi, area( bHi-bLo ) ) : -1;
+			if( mid < 0 ) continue;
+			int child = (int)nodes.size();
+			nodes[node].start = child;
+			nodes[node].count = 0;
+			nodes.push_back( { glm::vec3( 0 ), glm::vec3( 0 ), start, mid-start } );
+			nodes.push_back( { glm::vec3( 0 ), glm::vec3( 0 ), mid, start+count-mid } );
+			stack.push_back( { child+1, depth+1 } );
+			stack.push_back( { child, depth+1 } );
+		}
+
+		// pseudonormals: angle-weighted at the vertices, the sum of the two faces at an edge
+		std::vector<glm::vec3> faceNormal( n ), vertexNormal( mesh.vertices.size(), glm::vec3( 0 ) );
+		std::unordered_map<uint64_t, glm::vec3> edgeNormal;
+		auto edgeKey = []( uint32_t a, uint32_t b ) { return uint64_t( std::min( a, b ) )<<32 | std::max( a, b ); };
+		for( int i=0; i<n; i++ ) {
+			const glm::uvec3& t = mesh.faces[i];
+			glm::vec3 N = cross( mesh.vertices[t.y]-mesh.vertices[t.x], mesh.vertices[t.z]-mesh.vertices[t.x] );
+			float len = length( N );
+			faceNormal[i] = len > 0 ? N/len : glm::vec3( 0 );
+			for( int k=0; k<3; k++ ) {
+				glm::vec3 e0 = mesh.vertices[t[(k+1)%3]]-mesh.vertices[t[k]], e1 = mesh.vertices[t[(k+2)%3]]-mesh.vertices[t[k]];
+				float l0 = length( e0 ), l1 = length( e1 );
+				if( l0 > 0 && l1 > 0 )
+					vertexNormal[t[k]] += acosf( glm::clamp( dot( e0, e1 )/( l0*l1 ), -1.f, 1.f ) )*faceNormal[i];
+				edgeNormal[edgeKey( t[k], t[(k+1)%3] )] += faceNormal[i];
+			}
+		}
+		auto unit = []( const glm::vec3& v ) { float l = length( v ); return l > 0 ? v/l : v; };
+		corners.resize( 3*n );
+		normals.resize( n );
+		for( int k=0; k<n; k++ ) {
+			const glm::uvec3& t = mesh.faces[order[k]];
+			normals[k][0] = faceNormal[order[k]];
+			for( int j=0; j<3; j++ ) {
+				corners[3*k+j] = mesh.vertices[t[j]];
+				normals[k][1+j] = unit( vertexNormal[t[j]] );
+				normals[k][4+j] = unit( edgeNormal[edgeKey( t[j], t[(j+1)%3] )] );
+			}
+		}
+	}
+
+	// The closest point to x on the mesh, if one is nearer than maxDistance:
+	// its triangle, and its pseudonormal.
+	bool closest( const glm::vec3& x, float maxDistance, glm::vec3& point, glm::vec3& normal, int& triangle ) const {
+		if( nodes.empty() ) return false;
+		float best = maxDistance*maxDistance;
+		int bestRegion = 0;
+		triangle = -1;
+		int stack[MAX_DEPTH+1], top = 0;
+		if( boxDistance2( nodes[0], x ) < best ) stack[top++] = 0;
+		while( top > 0 ) {
+			const Node& node = nodes[stack[--top]];
+			if( boxDistance2( node, x ) >= best ) continue;
+			if( node.count > 0 ) {
+				for( int k=node.start; k<node.start+node.count; k++ ) {
+					int region;
+					glm::vec3 q = closestOnTriangle( x, corners[3*k], corners[3*k+1], corners[3*k+2], region );
+					float d2 = dot( x-q, x-q );
+					if( d2 < best ) {
+						best = d2;
+						point = q;
+						triangle = k;
+						bestRegion = region;
+					}
+				}
+				continue;
+			}
+			// the nearer child is popped first
+			float d0 = boxDistance2( nodes[node.start], x ), d1 = boxDistance2( nodes[node.start+1], x );
+			int near = d0 <= d1 ? node.start : node.start+1, far = near == node.start ? node.start+1 : node.start;
+			if( std::max( d0, d1 ) < best ) stack[top++] = far;
+			if( std::min( d0, d1 ) < best ) stack[top++] = near;
+		}
+		if( triangle < 0 ) return false;
+		normal = normals[triangle][bestRegion];
+		return true;
+	}
+
+	// The first triangle that the segment a-b crosses before tMax (in units
+	// of b-a), from either side.
+	bool raycast( const glm::vec3& a, const glm::vec3& b, float tMax, float& t, int& triangle ) const {
+		if( nodes.empty() ) return false;
+		const glm::vec3 s = b-a;
+		glm::vec3 inv;
+		for( int k=0; k<3; k++ ) inv[k] = s[k] != 0 ? 1/s[k] : 1e30f;
+		t = tMax;
+		triangle = -1;
+		int stack[MAX_DEPTH+1], top = 0;
+		stack[top++] = 0;
+		while( top > 0 ) {
+			const Node& node = nodes[stack[--top]];
+			glm::vec3 t0 = ( node.lo-a )*inv, t1 = ( node.hi-a )*inv;
+			glm::vec3 tNear = min( t0, t1 ), tFar = max( t0, t1 );
+			float enter = std::max( std::max( tNear.x, tNear.y ), std::max( tNear.z, 0.f ) );
+			float leave = std::min( std::min( tFar.x, tFar.y ), std::min( tFar.z, t ) );
+			if( enter > leave ) continue;
+			if( node.count == 0 ) {
+				stack[top++] = node.start+1;
+				stack[top++] = node.start;
+				continue;
+			}
+			// Moller & Trumbore
+			for( int k=node.start; k<node.start+node.count; k++ ) {
+				glm::vec3 e1 = corners[3*k+1]-corners[3*k], e2 = corners[3*k+2]-corners[3*k];
+				glm::vec3 pv = cross( s, e2 );
+				float det = dot( e1, pv );
+				if( fabsf( det ) < 1e-12f ) continue;
+				glm::vec3 tv = a-corners[3*k];
+				float u = dot( tv, pv )/det;
+				if( u < 0 || u > 1 ) continue;
+				glm::vec3 qv = cross( tv, e1 );
+				float v = dot( s, qv )/det;
+				if( v < 0 || u+v > 1 ) continue;
+				float tHit = dot( e2, qv )/det;
+				if( tHit >= 0 && tHit < t ) {
+					t = tHit;
+					triangle = k;
+				}
+			}
+		}
+		return triangle >= 0;
+	}
+
+	// Ericson, Real-Time Collision Detection 5.1.5. region: 0 face, 1-3
+	// vertex a-c, 4-6 edge ab, bc, ca.
+	static glm::vec3 closestOnTriangle( const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c,
+									   int& region ) {
+		glm::vec3 ab = b-a, ac = c-a, ap = p-a;
+		float d1 = dot( ab, ap ), d2 = dot( ac, ap );
+		if( d1 <= 0 && d2 <= 0 ) { region = 1; return a; }
+		glm::vec3 bp = p-b;
+		float d3 = dot( ab, bp ), d4 = dot( ac, bp );
+		if( d3 >= 0 && d4 <= d3 ) { region = 2; return b; }
+		float vc = d1*d4 - d3*d2;
+		if( vc <= 0 && d1 >= 0 && d3 <= 0 ) { region = 4; return a + d1/( d1-d3 )*ab; }
+		glm::vec3 cp = p-c;
+		float d5 = dot( ab, cp ), d6 = dot( ac, cp );
+		if( d6 >= 0 && d5 <= d6 ) { region = 3; return c; }
+		float vb = d5*d2 - d1*d6;
+		if( vb <= 0 && d2 >= 0 && d6 <= 0 ) { region = 6; return a + d2/( d2-d6 )*ac; }
+		float va = d3*d6 - d5*d4;
+		if( va <= 0 && d4-d3 >= 0 && d5-d6 >= 0 ) { region = 5; return b + ( d4-d3 )/( ( d4-d3 )+( d5-d6 ) )*( c-b ); }
+		float denom = 1/( va+vb+vc );
+		region = 0;
+		return a + ab*( vb*denom ) + ac*( vc*denom );
+	}
+
+private:
+	static float area( const glm::vec3& e ) { return e.x*e.y + e.y*e.z + e.z*e.x; }
+	static float boxDistance2( const Node& node, const glm::vec3& x ) {
+		glm::vec3 d = max( max( node.lo-x, x-node.hi ), glm::vec3( 0 ) );
+		return dot( d, d );
+	}
+	// Partitions order[start, start+count) at the cheapest of the 15 bin
+	// boundaries along each axis; -1 makes a leaf.
+	static int split( std::vector<int>& order, const std::vector<glm::vec3>& lo, const std::vector<glm::vec3>& hi,
+					 const std::vector<glm::vec3>& centroid, int start, int count,
+					 const glm::vec3& cLo, const glm::vec3& cHi, float parentArea ) {
+		const int BINS = 16, LEAF = 4;
+		if( count <= LEAF ) return -1;
+		float bestCost = count*parentArea;		// of a leaf, with the traversal at one triangle
+		int bestAxis = -1, bestBin = 0;
+		for( int axis=0; axis<3; axis++ ) {
+			float extent = cHi[axis]-cLo[axis];
+			if( extent <= 0 ) continue;
+			glm::vec3 binLo[BINS], binHi[BINS];
+			int binCount[BINS] = {};
+			for( int b=0; b<BINS; b++ ) {
+				binLo[b] = glm::vec3( 1e30f );
+				binHi[b] = glm::vec3( -1e30f );
+			}
+			for( int k=start; k<start+count; k++ ) {
+				int i = order[k];
+				int b = std::min( BINS-1, int( ( centroid[i][axis]-cLo[axis] )/extent*BINS ) );
+				binCount[b]++;
+				binLo[b] = min( binLo[b], lo[i] );
+				binHi[b] = max( binHi[b], hi[i] );
+			}
+			// areas and counts to the right of each boundary, then sweep from the left
+			float rightArea[BINS];
+			int rightCount[BINS];
+			glm::vec3 rLo( 1e30f ), rHi( -1e30f );
+			int rCount = 0;
+			for( int b=BINS-1; b>0; b-- ) {
+				rLo = min( rLo, binLo[b] );
+				rHi = max( rHi, binHi[b] );
+				rCount += binCount[b];
+				rightArea[b] = rCount ? area( rHi-rLo ) : 0;
+				rightCount[b] = rCount;
+			}
+			glm::vec3 lLo( 1e30f ), lHi( -1e30f );
+			int lCount = 0;
+			for( int b=1; b<BINS; b++ ) {
+				lLo = min( lLo, binLo[b-1] );
+				lHi = max( lHi, binHi[b-1] );
+				lCount += binCount[b-1];
+				if( lCount == 0 || rightCount[b] == 0 ) continue;
+				float cost = parentArea + lCount*area( lHi-lLo ) + rightCount[b]*rightArea[b];
+				if( cost < bestCost ) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+		if( bestAxis < 0 ) return -1;
+		float extent = cHi[bestAxis]-cLo[bestAxis];
+		auto mid = std::partition( order.begin()+start, order.begin()+start+count, [&]( int i ) {
+			return std::min( BINS-1, int( ( centroid[i][bestAxis]-cLo[bestAxis] )/extent*BINS ) ) < bestBin;
+		} );
+		return int( mid-order.begin() );
+	}
+};
+
+struct MeshCollider {
+	float thickness = 0.5f;		// of the surface, on the outside
+	float depth = 2.f;			// how far behind the surface a particle is still pushed out
+	float alpha = 0.6;
+	static constexpr float eps = 0.01;
+	// rigid placement: world = rotation * mesh + translation, and its motion
+	glm::mat3 rotation = glm::mat3( 1 );
+	glm::vec3 translation = glm::vec3( 0 );
+	glm::vec3 velocity = glm::vec3( 0 ), angularVelocity = glm::vec3( 0 );
+	TriangleBvh bvh;
+	int contacts = 0;			// particles resolved by the last resolve()
+
+	void build( const TriangleMesh& m ) {
+		mesh = m;
+		bvh.build( mesh );
+		displayDirty = true;
+	}
+	void setTransform( const glm::mat3& r, const glm::vec3& t ) {
+		rotation = r;
+		translation = t;
+		displayDirty = true;
+	}
+	// on the GL thread
+	void draw( const glm::vec4& color = glm::vec4( .7, .7, .75, 1 ) ) {
+		if( mesh.faces.empty() ) return;
+		if( displayDirty ) {
+			if( display.nVertices != (int)mesh.vertices.size() ) display.setFaces( mesh.faces, (int)mesh.vertices.size() );
+			std::vector<glm::vec3> world( mesh.vertices.size() );
+			for( size_t i=0; i<world.size(); i++ ) world[i] = rotation*mesh.vertices[i] + translation;
+			display.update( world.data() );
+			displayDirty = false;
+		}
+		drawMesh( display, color );
+	}
+
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		glm::mat3 toLocal = transpose( rotation );
+		glm::vec3 local = toLocal*( x-translation ), q, N;
+		int triangle;
+		if( !bvh.closest( local, std::max( thickness+eps, depth ), q, N, triangle ) ) return;
+		glm::vec3 dx = local-q;
+		float dist = length( dx );
+		bool behind = dot( dx, N ) < 0;
+		if( behind && dist > depth ) return;
+		if( dist > 1e-6f ) N = ( behind ? -dx : dx )/dist;
+		// the response in world space, relative to the moving surface
+		glm::vec3 Nw = rotation*N;
+		glm::vec3 surface = velocity + cross( angularVelocity, x-translation );
+		glm::vec3 v = vel-surface;
+		resolveContact( x, v, Nw, ( behind ? -dist : dist ) - thickness, alpha, eps );
+		vel = v+surface;
+	}
+
+	// The mesh is taken where it is at the end of the substep.
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		glm::mat3 toLocal = transpose( rotation );
+		glm::vec3 a = toLocal*( x0-translation ), b = toLocal*( x1-translation );
+		float t;
+		int triangle;
+		if( !bvh.raycast( a, b, std::min( hit.t, 1.f ), t, triangle ) ) return;
+		const glm::vec3& N = bvh.normals[triangle][0];
+		if( dot( b-a, N ) < 0 ) hit.consider( t, rotation*N, alpha, eps );
+	}
+
+	void resolve( Particles& p ) {
+		const int grain = 256;
+		if( bvh.empty() ) return;
+		contacts = resolveParticles( p, grain, [this]( glm::vec3& x, glm::vec3& v ) { resolveCollision( x, v ); } );
+	}
+
+private:
+	TriangleMesh mesh;
+	DynamicMesh display;
+	bool displayDirty = true;
+};
+
+#endif /* MeshCollider_hpp */
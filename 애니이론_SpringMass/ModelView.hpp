@@ -11,6 +11,8 @@
 #include "GLTools.hpp"
 #include <JGL/JGL_Widget.hpp>
 #include <functional>
+#include "AsyncLoader.hpp"
+#include "FrameCapture.hpp"
 
 struct FB {
 	size_t w = 0;
@@ -69,21 +71,37 @@ struct FB {
 		glViewport(0,0,w,h);
 		glDisable(GL_SCISSOR_TEST);
 	}
+	// Copies color and depth of another FB of the same size into this one.
+	void copyFrom( const FB& src ) {
+		GLint oldRead;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &oldRead );
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, src.fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+		glBlitFramebuffer(0,0,(GLint)src.w,(GLint)src.h,0,0,(GLint)w,(GLint)h,
+						  GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, oldRead);
+	}
 	void restoreVP() {
 		glViewport(oldVP[0], oldVP[1], oldVP[2], oldVP[3] );
 		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, oldFB);
 		if( oldSc )
 			glEnable(GL_SCISSOR_TEST);
 	}
-	void bindColor( GLuint prog, const std::string& name, GLuint slot ) {
+	void bindColor( GLuint prog, UniformId u, GLuint slot ) {
 		glActiveTexture( GL_TEXTURE0+slot );
 		glBindTexture( GL_TEXTURE_2D, color );
-		setUniform( prog, name, (int)slot );
+		setUniform( prog, u, (int)slot );
 	}
-	void bindDepth( GLuint prog, const std::string& name, GLuint slot ) {
+	void bindDepth( GLuint prog, UniformId u, GLuint slot ) {
 		glActiveTexture( GL_TEXTURE0+slot );
 		glBindTexture( GL_TEXTURE_2D, depth );
-		setUniform( prog, name, (int)slot );
+		setUniform( prog, u, (int)slot );
+	}
+	void bindColor( GLuint prog, const std::string& name, GLuint slot ) {
+		bindColor( prog, uniformId( name ), slot );
+	}
+	void bindDepth( GLuint prog, const std::string& name, GLuint slot ) {
+		bindDepth( prog, uniformId( name ), slot );
 	}
 };
 
@@ -143,8 +161,9 @@ struct View3D: JGL::Widget {
 		return glm::perspective( fov, w()/h(), 10.f, 1000.f );
 	}
 	virtual void setViewProj( GLuint prog, const std::string& viewName="viewMat", const std::string& projName="projMat" ) {
-		setUniform(prog, "projMat", getProjMat());
-		setUniform(prog, "viewMat", getViewMat());
+		static const UniformId U_PROJMAT = uniformId( "projMat" ), U_VIEWMAT = uniformId( "viewMat" );
+		setUniform(prog, U_PROJMAT, getProjMat());
+		setUniform(prog, U_VIEWMAT, getViewMat());
 	}
 	virtual void drawContents(NVGcontext* vg, const glm::rect&r, int a ) override {
 	}
@@ -158,19 +177,140 @@ struct ModelView : View3D {
 	//	glm::vec3 lightPos = {10,50,30};
 	GLuint renderProg=0, renderVert=0, renderFrag=0;
 	GLuint const_Prog=0, const_Vert=0, const_Frag=0;
+	GLuint renderProgInst=0, const_ProgInst=0;
+	GLuint renderProgImp=0, const_ProgImp=0;
+	bool useInstancing = true;	// batch primitives into instanced draws when the shaders allow it
+	bool useLod = true;			// coarser spheres/cylinders when they are small on screen
+	bool useCulling = true;		// skip primitives outside the light/camera frustum
+	bool useImpostors = false;	// ray-cast spheres/cylinders on quads instead of meshes (instanced only)
+	CullStats shadowCullStats, mainCullStats;	// of the last frame
 	
 	std::function<void()> renderFunction = [](){};
 	std::function<void()> wireFunction   = [](){};
+	// renderFunction runs once per frame into drawList and both passes replay it.
+	// Turn off if it issues GL calls other than drawQuad/drawSphere/drawCylinder.
+	bool recordDrawList = true;
+	DrawList drawList;
 	
 	FB shadowMap;
+	// Depth of the static draws alone, re-rendered only when the light or the
+	// static content changes; the shadow pass starts from a copy of it.
+	FB staticShadowMap;
+	bool staticShadowValid = false;
+	glm::vec3 staticShadowLight, staticShadowCenter;
+	std::vector<DrawCommand> staticShadowContent;
+	void invalidateStaticShadow() { staticShadowValid = false; }
+	
+	bool shadersRequested = false;
 	
+	// Shader sources are read on the worker pool; only compile/link runs on the GL thread.
+	AsyncLoad loadShaders() {
+		co_await resumeOnWorker();
+		std::string rv = readText( "shader.vert" ), rf = readText( "shader.frag" );
+		std::string cv = readText( "const.vert" ), cf = readText( "const.frag" );
+		rv = useFrameConstants( rv );
+		rf = useFrameConstants( rf );
+		cv = useFrameConstants( cv );
+		cf = useFrameConstants( cf );
+		co_await resumeOnGL();
+		renderVert = compileShader( rv, GL_VERTEX_SHADER );
+		renderFrag = compileShader( rf, GL_FRAGMENT_SHADER );
+		renderProg = buildProgram( renderVert, renderFrag );
+		const_Vert = compileShader( cv, GL_VERTEX_SHADER );
+		const_Frag = compileShader( cf, GL_FRAGMENT_SHADER );
+		const_Prog = buildProgram( const_Vert, const_Frag );
+		renderProgInst = buildInstancedProgram( rv, rf );
+		const_ProgInst = buildInstancedProgram( cv, cf );
+		if( !renderProgInst || !const_ProgInst )
+			std::cerr<<"[WARNING] Shaders do not support instancing, drawing primitives one by one\n";
+		renderProgImp = buildImpostorProgram( true );
+		const_ProgImp = buildImpostorProgram( false );
+		if( !renderProgImp || !const_ProgImp )
+			std::cerr<<"[WARNING] Impostor shaders did not build, drawing spheres and cylinders as meshes\n";
+		redraw();
+	}
+	GLuint frameUBO = 0;
+	GLint frameUBOStride = 0;
+	// One FrameConstants slot per view (0: light, 1: camera), uploaded once per frame.
+	void uploadFrameConstants( const FrameConstants* constants, int n ) {
+		if( !frameUBO ) {
+			GLint align = 256;
+			glGetIntegerv( GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align );
+			frameUBOStride = (GLint)((sizeof(FrameConstants)+align-1)/align*align);
+			glGenBuffers( 1, &frameUBO );
+			glBindBuffer( GL_UNIFORM_BUFFER, frameUBO );
+			glBufferData( GL_UNIFORM_BUFFER, frameUBOStride*n, nullptr, GL_DYNAMIC_DRAW );
+		}
+		glBindBuffer( GL_UNIFORM_BUFFER, frameUBO );
+		for( int i=0; i<n; i++ )
+			glBufferSubData( GL_UNIFORM_BUFFER, i*frameUBOStride, sizeof(FrameConstants), constants+i );
+		glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+	}
+	void bindFrameConstants( int slot ) {
+		glBindBufferRange( GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, frameUBO, slot*frameUBOStride, sizeof(FrameConstants) );
+	}
+	// Frame capture: setting captureOutput (a FrameSink path) starts capturing
+	// at the next drawGL with the viewport size; clearing it stops.
+	std::string captureOutput;
+	float captureFps = 60;
+	FrameCapture frameCapture;
+	FrameSink captureSink;
+	int capturedFrames = -1;	// -1 while not capturing
+	void updateCapture() {
+		if( captureOutput.empty() ) {
+			if( capturedFrames>=0 ) stopCapture();
+			return;
+		}
+		GLint vp[4], fbo;
+		glGetIntegerv( GL_VIEWPORT, vp );
+		glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &fbo );
+		if( capturedFrames<0 ) {
+			if( !captureSink.open( captureOutput, vp[2], vp[3], captureFps ) ) {
+				captureOutput.clear();
+				return;
+			}
+			frameCapture.create( vp[2], vp[3], [this]( const uint8_t* rgb, int frame ) {
+				return captureSink.write( rgb, frame );
+			} );
+			capturedFrames = 0;
+		}
+		frameCapture.capture( fbo, vp[0], vp[1], capturedFrames++ );
+	}
+	// Writes out the frames still in flight; needs the GL context.
+	void stopCapture() {
+		captureOutput.clear();
+		if( capturedFrames<0 ) return;
+		frameCapture.clearGL();
+		captureSink.close();
+		capturedFrames = -1;
+	}
+	void drawPrimitives( const std::function<void()>& func, bool instanced ) {
+		if( instanced ) beginInstancing();
+		func();
+		if( instanced ) endInstancing();
+	}
 	virtual void drawGL() override {
+		// Uniforms set every frame, interned once.
+		static const UniformId U_MODELMAT = uniformId( "modelMat" ), U_PROJMAT = uniformId( "projMat" ),
+			U_VIEWMAT = uniformId( "viewMat" ), U_COLOR = uniformId( "color" ),
+			U_LIGHT_POS = uniformId( "lightPos" ), U_IBL_COEFFS = uniformId( "iblCoeffs" ),
+			U_SHADOW_ENABLED = uniformId( "shadowEnabled" ),
+			U_SHADOW_MAP = uniformId( "shadowMap" ), U_SHADOW_PROJ = uniformId( "shadowProj" ),
+			U_SHADOW_ZNEAR = uniformId( "shadowZNear" ), U_SHADOW_ZFAR = uniformId( "shadowZFar" ),
+			U_LIGHT_DIR = uniformId( "lightDir" ), U_COS_LIGHT_FOV = uniformId( "cosLightFov" ),
+			U_SHADOW_BIASED_VP = uniformId( "shadowBiasedVP" );
 		glClearColor(0,0,0,0);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 		
+		AsyncLoader::pumpGL();
+		if( AsyncLoader::busy() )
+			animate();		// keep polling until pending loads have landed
 		if( renderProg==0 ) {
-			std::tie(renderProg,renderVert,renderFrag)= loadProgram( "shader.vert", "shader.frag" );
-			std::tie(const_Prog,const_Vert,const_Frag)= loadProgram( "const.vert", "const.frag" );
+			if( !shadersRequested ) {
+				shadersRequested = true;
+				loadShaders();
+			}
+			return;
 		}
 		
 		glm::mat4 shadowV, shadowP;
@@ -179,52 +319,122 @@ struct ModelView : View3D {
 		glEnable(GL_DEPTH_TEST);
 		glDepthFunc(GL_LEQUAL);
 		
+		bool instanced = useInstancing && renderProgInst && const_ProgInst;
+		GLuint constProg = instanced ? const_ProgInst : const_Prog;
+		GLuint mainProg = instanced ? renderProgInst : renderProg;
+		bool impostors = instanced && useImpostors && renderProgImp && const_ProgImp;
+		GLuint constImp = impostors ? const_ProgImp : 0;
+		GLuint mainImp = impostors ? renderProgImp : 0;
+		
+		shadowV = glm::lookAt(lightPos, sceneCenter, glm::vec3(0,1,0));
+		shadowP = glm::perspective(shadowFov, 1.f, shadowZNear, shadowZFar);
+		FrameConstants frameConstants[2] = {
+			{ shadowV, shadowP, glm::vec4(lightPos,1) },
+			{ getViewMat(), getProjMat(), glm::vec4(lightPos,1) } };
+		uploadFrameConstants( frameConstants, 2 );
+		
+		if( recordDrawList ) {
+			drawList.clear();
+			beginRecording( drawList );
+			renderFunction();
+			endRecording();
+		}
+		auto drawScene = [&]() {
+			if( recordDrawList ) replay( drawList, instanced );
+			else drawPrimitives( renderFunction, instanced );
+		};
+		
 		if( enableShadow ) {
+			for( GLuint prog : { constImp, constProg } ) if( prog ) {
+				useProgram(prog);
+				setUniform(prog, U_MODELMAT, glm::mat4(1));
+				setUniform(prog, U_PROJMAT, shadowP);
+				setUniform(prog, U_VIEWMAT, shadowV);
+			}
+			bindFrameConstants( 0 );
+			if( constImp ) setImpostorProgram( constImp, shadowV, shadowP );
+			if( useLod ) setLodView( shadowV, shadowP, 1024 );
+			if( useCulling ) setCullFrustum( shadowP*shadowV );
+			resetCullStats();
+			bool cached = recordDrawList && !drawList.staticCommands.empty();
+			if( cached && ( !staticShadowValid || staticShadowLight != lightPos
+						   || staticShadowCenter != sceneCenter
+						   || staticShadowContent != drawList.staticCommands ) ) {
+				staticShadowMap.create(1024,1024);
+				staticShadowMap.setToTarget();
+				glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+				replay( drawList.staticCommands, instanced );
+				staticShadowMap.restoreVP();
+				staticShadowLight = lightPos;
+				staticShadowCenter = sceneCenter;
+				staticShadowContent = drawList.staticCommands;
+				staticShadowValid = true;
+			}
 			shadowMap.create(1024,1024);
 			shadowMap.setToTarget();
-			glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-			shadowV = glm::lookAt(lightPos, sceneCenter, glm::vec3(0,1,0));
-			shadowP = glm::perspective(shadowFov, 1.f, shadowZNear, shadowZFar);
-			glUseProgram(const_Prog);
-			setUniform(const_Prog, "modelMat", glm::mat4(1));
-			setUniform(const_Prog, "projMat", shadowP);
-			setUniform(const_Prog, "viewMat", shadowV);
-			renderFunction();
+			if( cached ) {
+				shadowMap.copyFrom( staticShadowMap );
+				replay( drawList.commands, instanced );
+			}
+			else {
+				glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+				drawScene();
+			}
 			shadowMap.restoreVP();
+			clearImpostorProgram();
+			shadowCullStats = cullStats();
 		}
 		
-		glUseProgram( renderProg );
-		setUniform(renderProg, "color", glm::vec4(.8,.8,.8,1) );
-		setUniform(renderProg, "modelMat",glm::mat4(1));
-		setViewProj( renderProg );
+		useProgram( mainProg );
+		bindFrameConstants( 1 );
+		if( useLod ) {
+			GLint vp[4];
+			glGetIntegerv( GL_VIEWPORT, vp );
+			setLodView( getViewMat(), getProjMat(), (float)vp[3] );
+		}
+		if( useCulling ) setCullFrustum( getProjMat()*getViewMat() );
+		else clearCullFrustum();
+		resetCullStats();
+		for( GLuint prog : { mainImp, mainProg } ) if( prog ) {
+			useProgram( prog );
+			setUniform(prog, U_COLOR, glm::vec4(.8,.8,.8,1) );
+			setUniform(prog, U_MODELMAT,glm::mat4(1));
+			setViewProj( prog );
 
-		setUniform(renderProg, "lightPos", lightPos );
-		setUniform(renderProg, "iblCoeffs", iblCoeffs, 9);
+			setUniform(prog, U_LIGHT_POS, lightPos );
+			setUniform(prog, U_IBL_COEFFS, iblCoeffs, 9);
 		
-		if( enableShadow ) {
-			setUniform(renderProg, "shadowEnabled", 1);
-			shadowMap.bindDepth(renderProg, "shadowMap", 0);
-			setUniform(renderProg, "shadowProj", shadowP );
-			setUniform(renderProg, "shadowZNear", shadowZNear );
-			setUniform(renderProg, "shadowZFar", shadowZFar );
-			setUniform(renderProg, "lightDir", normalize( sceneCenter-lightPos ) );
-			setUniform(renderProg, "cosLightFov", cosf(shadowFov/2) );
-			setUniform(renderProg, "shadowBiasedVP",
-					   glm::translate(glm::vec3(0.5))*glm::scale(glm::vec3(0.5))
-					   *shadowP*shadowV);
+			if( enableShadow ) {
+				setUniform(prog, U_SHADOW_ENABLED, 1);
+				shadowMap.bindDepth(prog, U_SHADOW_MAP, 0);
+				setUniform(prog, U_SHADOW_PROJ, shadowP );
+				setUniform(prog, U_SHADOW_ZNEAR, shadowZNear );
+				setUniform(prog, U_SHADOW_ZFAR, shadowZFar );
+				setUniform(prog, U_LIGHT_DIR, normalize( sceneCenter-lightPos ) );
+				setUniform(prog, U_COS_LIGHT_FOV, cosf(shadowFov/2) );
+				setUniform(prog, U_SHADOW_BIASED_VP,
+						   glm::translate(glm::vec3(0.5))*glm::scale(glm::vec3(0.5))
+						   *shadowP*shadowV);
+			}
+			else
+				setUniform(prog, U_SHADOW_ENABLED, 0);
 		}
-		else
-			setUniform(renderProg, "shadowEnabled", 0);
-		renderFunction();
+		if( mainImp ) setImpostorProgram( mainImp, getViewMat(), getProjMat() );
+		drawScene();
+		clearImpostorProgram();
 		
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glLineWidth(.2);
-		glUseProgram( const_Prog );
-		setUniform(const_Prog, "color", glm::vec4(0,0,0,.2));
-		setUniform(const_Prog, "modelMat", glm::mat4(1));
-		setViewProj( const_Prog );
-		wireFunction();
+		useProgram( constProg );
+		setUniform(constProg, U_COLOR, glm::vec4(0,0,0,.2));
+		setUniform(constProg, U_MODELMAT, glm::mat4(1));
+		setViewProj( constProg );
+		drawPrimitives( wireFunction, instanced );
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+		mainCullStats = cullStats();
+		clearCullFrustum();
+		clearLodView();
+		updateCapture();
 	}
 };
 
@@ -0,0 +1,118 @@
+//
+//  Parallel.hpp
+//  SpringMass
+//
+//  Fork-join loops for per-frame work (normals, forces). parallelFor() cuts
+//  [begin,end) into chunks of `grain` indices that the calling thread and a
+//  persistent pool of workers take from a shared counter; it returns when
+//  every chunk is done. Calls are serialized and must not nest.
+//
+
+#ifndef Parallel_hpp
+#define Parallel_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ParallelPool {
+	std::vector<std::thread> threads;
+	std::mutex callMutex;				// one loop at a time
+	std::mutex mutex;
+	std::condition_variable wake, done;
+	const std::function<void(int,int)>* body = nullptr;
+	std::atomic<int> next{ 0 };
+	int end = 0, grain = 1;
+	int generation = 0;
+	int running = 0;					// workers that have not finished the current loop
+	bool quit = false;
+
+	ParallelPool( int n = 0 ) {
+		if( n <= 0 ) n = (int)std::thread::hardware_concurrency();
+		for( int i=1; i<n; i++ )		// the caller is the n-th thread
+			threads.emplace_back( [this] { loop(); } );
+	}
+	~ParallelPool() {
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			quit = true;
+		}
+		wake.notify_all();
+		for( auto& t: threads ) t.join();
+	}
+	int size() const { return (int)threads.size()+1; }
+
+	void run( int b, int e, int g, const std::function<void(int,int)>& f ) {
+		std::lock_guard<std::mutex> call( callMutex );
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			body = &f;
+			next = b;
+			end = e;
+			grain = std::max( 1, g );
+			running = (int)threads.size();
+			generation++;
+		}
+		wake.notify_all();
+		work();
+		std::unique_lock<std::mutex> lock( mutex );
+		done.wait( lock, [this] { return running==0; } );
+		body = nullptr;
+	}
+
+private:
+	void work() {
+		for( ;; ) {
+			int i = next.fetch_add( grain );
+			if( i >= end ) break;
+			(*body)( i, std::min( i+grain, end ) );
+		}
+	}
+	void loop() {
+		int seen = 0;
+		for( ;; ) {
+			{
+				std::unique_lock<std::mutex> lock( mutex );
+				wake.wait( lock, [&] { return quit || generation != seen; } );
+				if( quit ) return;
+				seen = generation;
+			}
+			work();
+			std::lock_guard<std::mutex> lock( mutex );
+			if( --running == 0 ) done.notify_one();
+		}
+	}
+};
+
+inline std::unique_ptr<ParallelPool>& parallelPoolInstance() {
+	static std::unique_ptr<ParallelPool> pool;
+	return pool;
+}
+inline ParallelPool& parallelPool() {
+	auto& pool = parallelPoolInstance();
+	if( !pool ) pool = std::make_unique<ParallelPool>();
+	return *pool;
+}
+// Replaces the pool with one of n threads, the caller included (0: one per
+// hardware thread). Not while a loop is running.
+inline void setParallelThreads( int n ) {
+	parallelPoolInstance() = std::make_unique<ParallelPool>( n );
+}
+
+// body(chunkBegin, chunkEnd) for consecutive chunks covering [begin,end).
+// Ranges of one chunk or less run inline on the caller.
+static inline void parallelFor( int begin, int end, const std::function<void(int,int)>& body, int grain = 256 ) {
+	if( end <= begin ) return;
+	if( end-begin <= grain || parallelPool().size() == 1 ) {
+		body( begin, end );
+		return;
+	}
+	parallelPool().run( begin, end, grain, body );
+}
+
+#endif /* Parallel_hpp */
@@ -0,0 +1,151 @@
+//
+//  SdfCollider.hpp
+//  SpringMass
+//
+//  A static collider of any complexity at the cost of one lookup per
+//  particle. bake() samples the signed distance to a TriangleBvh, and its
+//  gradient, on a dense grid around the mesh once; rows of samples run on
+//  the Parallel.hpp pool, and each sample only searches the BVH within the
+//  distance of its neighbour in the row plus one cell, since the distance
+//  changes no faster than that. At run time a particle reads the eight
+//  samples around it, interpolates trilinearly and resolves like
+//  Sphere::resolveCollision(), so the cost does not depend on the triangle
+//  count. The surface is only as sharp as the cell size, and a particle
+//  deep inside, near where the closest point jumps from one part of the mesh
+//  to another, may be pushed out a different way than MeshCollider would
+//  (by up to 5 units on bench.cpp's bumpy sphere). sweep() marches the
+//  part of a particle's path inside the grid by the distances it reads, so
+//  that it stops at the surface instead of stepping over a thin part.
+//  The grid is in the mesh's own space; rotation and translation place it
+//  as MeshCollider's do, so a collider baked from a MeshCollider takes its
+//  transform with setTransform() and moves with it without a new bake.
+//
+
+#ifndef SdfCollider_hpp
+#define SdfCollider_hpp
+
+#include "MeshCollider.hpp"
+
+struct SdfCollider {
+	float thickness = 0.5f;		// of the surface, on the outside
+	float alpha = 0.6;
+	static constexpr float eps = 0.01;
+	glm::ivec3 dims = glm::ivec3( 0 );
+	glm::vec3 origin = glm::vec3( 0 );		// of sample (0,0,0)
+	float cellSize = 1;
+	std::vector<glm::vec4> samples;			// unit gradient, signed distance; x fastest
+	// rigid placement: world = rotation * grid space + translation, and its motion
+	glm::mat3 rotation = glm::mat3( 1 );
+	glm::vec3 translation = glm::vec3( 0 );
+	glm::vec3 velocity = glm::vec3( 0 ), angularVelocity = glm::vec3( 0 );
+	int contacts = 0;						// particles resolved by the last resolve()
+
+	bool empty() const { return samples.empty(); }
+	void setTransform( const glm::mat3& r, const glm::vec3& t ) {
+		rotation = r;
+		translation = t;
+	}
+
+	// Samples the mesh's bounding box grown by `padding` every `cell` units.
+	// The mesh should be closed, as for MeshCollider. `loop` runs the rows:
+	// AsyncLoader::workerFor() keeps a bake in the background off the pool.
+	using Loop = void (*)( int, int, const std::function<void(int,int)>&, int );
+	void bake( const TriangleBvh& bvh, float cell, float padding, Loop loop = parallelFor ) {
+		samples.clear();
+		if( bvh.empty() ) return;
+		cellSize = cell;
+		origin = bvh.nodes[0].lo - glm::vec3( padding );
+		glm::vec3 extent = bvh.nodes[0].hi + glm::vec3( padding ) - origin;
+		for( int k=0; k<3; k++ ) dims[k] = std::max( 2, (int)ceilf( extent[k]/cell )+1 );
+		samples.resize( size_t( dims.x )*dims.y*dims.z );
+		loop( 0, dims.y*dims.z, [&]( int b, int e ) {
+			for( int row=b; row<e; row++ ) {
+				float reach = 1e30f;
+				for( int i=0; i<dims.x; i++ ) {
+					glm::vec3 x = origin + cell*glm::vec3( i, row%dims.y, row/dims.y ), q, N;
+					int triangle;
+					if( !bvh.closest( x, reach, q, N, triangle ) ) bvh.closest( x, 1e30f, q, N, triangle );
+					glm::vec3 d = x-q;
+					float dist = length( d );
+					float sign = dot( d, N ) < 0 ? -1.f : 1.f;
+					glm::vec3 gradient = dist > 1e-6f ? sign*d/dist : N;
+					samples[size_t( row )*dims.x + i] = glm::vec4( gradient, sign*dist );
+					reach = dist + cell*1.001f;
+				}
+			}
+		}, 8 );
+	}
+
+	// Trilinear distance and unnormalized gradient; false outside the grid.
+	bool lookup( const glm::vec3& x, float& distance, glm::vec3& gradient ) const {
+		glm::vec3 g = ( x-origin )/cellSize;
+		if( !( g.x >= 0 && g.y >= 0 && g.z >= 0 && g.x <= dims.x-1 && g.y <= dims.y-1 && g.z <= dims.z-1 ) ) return false;
+		glm::ivec3 c = min( glm::ivec3( g ), dims-glm::ivec3( 2 ) );
+		glm::vec3 t = g-glm::vec3( c );
+		const glm::vec4* s = &samples[( size_t( c.z )*dims.y + c.y )*dims.x + c.x];
+		const size_t dy = dims.x, dz = size_t( dims.x )*dims.y;
+		glm::vec4 v = ( 1-t.z )*( ( 1-t.y )*( ( 1-t.x )*s[0] + t.x*s[1] ) + t.y*( ( 1-t.x )*s[dy] + t.x*s[dy+1] ) )
+			+ t.z*( ( 1-t.y )*( ( 1-t.x )*s[dz] + t.x*s[dz+1] ) + t.y*( ( 1-t.x )*s[dz+dy] + t.x*s[dz+dy+1] ) );
+		distance = v.w;
+		gradient = glm::vec3( v );
+		return true;
+	}
+
+	void resolveCollision( glm::vec3& x, glm::vec3& vel ) const {
+		float d;
+		glm::vec3 gradient;
+		if( !lookup( transpose( rotation )*( x-translation ), d, gradient ) || d-thickness >= eps ) return;
+		float len = length( gradient );
+		if( len < 1e-6f ) return;
+		// the response in world space, relative to the moving surface
+		glm::vec3 surface = velocity + cross( angularVelocity, x-translation );
+		glm::vec3 v = vel-surface;
+		resolveContact( x, v, rotation*gradient/len, d-thickness, alpha, eps );
+		vel = v+surface;
+	}
+
+	// The grid is taken where it is at the end of the substep. A fast
+	// particle may start or end the path outside the grid, so only the part
+	// of the path inside it is marched.
+	void sweep( const glm::vec3& x0, const glm::vec3& x1, SweepHit& hit ) const {
+		if( empty() ) return;
+		glm::mat3 toLocal = transpose( rotation );
+		glm::vec3 a = toLocal*( x0-translation ), b = toLocal*( x1-translation );
+		float len = length( b-a );
+		if( len == 0 ) return;
+		glm::vec3 lo = origin, hi = origin + cellSize*glm::vec3( dims-glm::ivec3( 1 ) );
+		float enter = 0, leave = std::min( hit.t, 1.f );
+		for( int k=0; k<3; k++ ) {
+			float s = b[k]-a[k];
+			if( s == 0 ) {
+				if( a[k] < lo[k] || a[k] > hi[k] ) return;
+				continue;
+			}
+			float t0 = ( lo[k]-a[k] )/s, t1 = ( hi[k]-a[k] )/s;
+			enter = std::max( enter, std::min( t0, t1 ) );
+			leave = std::min( leave, std::max( t0, t1 ) );
+		}
+		if( enter > leave ) return;
+		float d, t = enter, minStep = 0.25f*cellSize/len;
+		glm::vec3 gradient;
+		for( int i=0; i<64 && t <= leave; i++ ) {
+			// clamped, as the entry and exit points may round to just outside
+			lookup( glm::clamp( a + t*( b-a ), lo, hi ), d, gradient );
+			if( d < thickness ) {
+				if( i == 0 ) return;		// starts in contact, which resolveCollision() handles
+				float g = length( gradient );
+				if( g > 1e-6f ) hit.consider( t, rotation*gradient/g, alpha, eps );
+				return;
+			}
+			t += std::max( ( d-thickness )/len, minStep );
+		}
+	}
+
+	void resolve( Particles& p ) {
+		const int grain = 1024;
+		if( empty() ) return;
+		contacts = resolveParticles( p, grain, [this]( glm::vec3& x, glm::vec3& v ) { resolveCollision( x, v ); } );
+	}
+};
+
+#endif /* SdfCollider_hpp */
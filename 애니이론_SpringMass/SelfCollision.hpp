@@ -0,0 +1,172 @@
+//
+//  SelfCollision.hpp
+//  SpringMass
+//
+//  Particle-particle self-collision for the cloth. A uniform grid of cells
+//  two thicknesses wide is hashed into a power-of-two table of 2n to 4n
+//  buckets and rebuilt on every call by a counting sort on the Parallel.hpp
+//  pool (atomic bucket counts, a blocked prefix sum, an atomic scatter,
+//  then each bucket sorted so the result does not depend on the threads).
+//  Each particle then looks at the (at most eight) cells within a
+//  thickness of it, is pushed out of the others closer than `thickness`,
+//  skipping those it shares a spring with, and loses the approaching part
+//  of its relative velocity. Every particle only writes its own correction,
+//  so the pass needs no locks; the work is linear in the particle count.
+//
+
+#ifndef SelfCollision_hpp
+#define SelfCollision_hpp
+
+#include <atomic>
+#include <memory>
+#include "Cloth.hpp"
+
+struct SpatialHash {
+	float spacing = 1;
+	int tableSize = 0;
+	std::vector<int> cellStart;		// bucket b holds entries[cellStart[b]] .. entries[cellStart[b+1]-1]
+	std::vector<int> entries;		// particle indices, sorted by bucket
+	std::vector<glm::vec3> positions;	// of the entries, to scan buckets without gathering
+
+	int cell( float x ) const { return (int)floorf( x/spacing ); }
+	// Rows of cells along x take consecutive buckets, so that a query reads
+	// short runs of the table instead of scattered buckets.
+	int bucket( int x, int y, int z ) const {
+		uint32_t h = ( uint32_t( y )*689287499u ^ uint32_t( z )*283923481u ) + uint32_t( x );
+		return int( h & uint32_t( tableSize-1 ) );
+	}
+	void build( const Particles& p ) {
+		const int n = p.count, grain = 4096;
+		int size = 1;
+		while( size < 2*n ) size *= 2;
+		if( tableSize != size ) {
+			tableSize = size;
+			counts.reset( new std::atomic<int>[tableSize] );
+		}
+		bucketOf.resize( n );
+		entries.resize( n );
+		positions.resize( n );
+		cellStart.resize( tableSize+1 );
+		parallelFor( 0, tableSize, [&]( int b, int e ) {
+			for( int i=b; i<e; i++ ) counts[i].store( 0, std::memory_order_relaxed );
+		}, grain );
+		parallelFor( 0, n, [&]( int b, int e ) {
+			for( int i=b; i<e; i++ ) {
+				bucketOf[i] = bucket( cell( p.px[i] ), cell( p.py[i] ), cell( p.pz[i] ) );
+				counts[bucketOf[i]].fetch_add( 1, std::memory_order_relaxed );
+			}
+		}, grain );
+		// exclusive prefix sum: block totals, a serial scan over the blocks, then each block
+		blockSum.assign( ( tableSize+grain-1 )/grain + 1, 0 );
+		parallelFor( 0, tableSize, [&]( int b, int e ) {
+			int s = 0;
+			for( int i=b; i<e; i++ ) s += counts[i].load( std::memory_order_relaxed );
+			blockSum[b/grain+1] = s;
+		}, grain );
+		for( size_t i=1; i<blockSum.size(); i++ ) blockSum[i] += blockSum[i-1];
+		parallelFor( 0, tableSize, [&]( int b, int e ) {
+			int s = blockSum[b/grain];
+			for( int i=b; i<e; i++ ) {
+				cellStart[i] = s;
+				s += counts[i].load( std::memory_order_relaxed );
+				counts[i].store( cellStart[i], std::memory_order_relaxed );	// fill cursor
+			}
+		}, grain );
+		cellStart[tableSize] = n;
+		parallelFor( 0, n, [&]( int b, int e ) {
+			for( int i=b; i<e; i++ )
+				entries[counts[bucketOf[i]].fetch_add( 1, std::memory_order_relaxed )] = i;
+		}, grain );
+		parallelFor( 0, tableSize, [&]( int b, int e ) {
+			for( int i=b; i<e; i++ ) {
+				if( cellStart[i+1]-cellStart[i] > 1 )
+					std::sort( entries.begin()+cellStart[i], entries.begin()+cellStart[i+1] );
+				for( int k=cellStart[i]; k<cellStart[i+1]; k++ ) positions[k] = p.position( entries[k] );
+			}
+		}, grain );
+	}
+	// f(j, position of j) for every particle in the cells that the cube of
+	// half-width r around x touches, each bucket once. r must not exceed the
+	// spacing; up to half of it, that is at most 2x2x2 cells.
+	template<typename F>
+	void query( const glm::vec3& x, float r, F f ) const {
+		const int x0 = cell( x.x-r ), x1 = cell( x.x+r ), y0 = cell( x.y-r ), y1 = cell( x.y+r );
+		const int z0 = cell( x.z-r ), z1 = cell( x.z+r );
+		int seen[27], nSeen = 0;
+		for( int k=z0; k<=std::min( z1, z0+2 ); k++ ) for( int j=y0; j<=std::min( y1, y0+2 ); j++ )
+		for( int i=x0; i<=std::min( x1, x0+2 ); i++ ) {
+			int b = bucket( i, j, k );
+			if( cellStart[b] == cellStart[b+1] || std::find( seen, seen+nSeen, b ) != seen+nSeen ) continue;
+			seen[nSeen++] = b;
+			for( int e=cellStart[b]; e<cellStart[b+1]; e++ ) f( entries[e], positions[e] );
+		}
+	}
+
+private:
+	std::unique_ptr<std::atomic<int>[]> counts;
+	std::vector<int> bucketOf, blockSum;
+};
+
+struct SelfCollision {
+	float thickness = 1.5f;		// below the rest length of the springs
+	int contacts = 0;			// particle pairs pushed apart by the last call
+	SpatialHash hash;
+
+	void resolve( Particles& p, const Springs& s ) {
+		const int n = p.count, grain = 1024;
+		const bool adjacency = (int)s.adjStart.size() == n+1;
+		hash.spacing = 2*thickness;
+		hash.build( p );
+		newX.resize( n );
+		newV.resize( n );
+		blockContacts.assign( ( n+grain-1 )/grain, 0 );
+		parallelFor( 0, n, [&]( int b, int e ) {
+			int found = 0;
+			for( int i=b; i<e; i++ ) {
+				glm::vec3 x = p.position(i), v = p.velocity(i), dx( 0 ), dv( 0 );
+				float wi = p.invMass[i];
+				if( wi > 0 ) hash.query( x, thickness, [&]( int j, const glm::vec3& xj ) {
+					glm::vec3 d = x - xj;
+					float d2 = dot( d, d );
+					if( d2 < thickness*thickness && j != i && d2 > 0 && push( p, s, adjacency, i, j, d, d2, v, dx, dv ) )
+						found++;
+				} );
+				newX[i] = x + dx;
+				newV[i] = v + dv;
+			}
+			blockContacts[b/grain] = found;
+		}, grain );
+		parallelFor( 0, n, [&]( int b, int e ) {
+			for( int i=b; i<e; i++ ) {
+				p.setPosition( i, newX[i] );
+				p.setVelocity( i, newV[i] );
+			}
+		}, grain );
+		contacts = 0;
+		for( int c: blockContacts ) contacts += c;
+		contacts /= 2;
+	}
+
+private:
+	std::vector<glm::vec3> newX, newV;
+	std::vector<int> blockContacts;
+
+	// Adds particle i's share of separating it from j, unless a spring joins
+	// them. Kept out of the candidate loop, which is mostly rejections.
+	bool push( const Particles& p, const Springs& s, bool adjacency, int i, int j, const glm::vec3& d, float d2,
+			  const glm::vec3& v, glm::vec3& dx, glm::vec3& dv ) const {
+		if( adjacency ) {
+			const int* first = s.adjParticle.data()+s.adjStart[i], * last = s.adjParticle.data()+s.adjStart[i+1];
+			if( std::find( first, last, j ) != last ) return false;
+		}
+		float wi = p.invMass[i];
+		float dist = sqrtf( d2 ), share = wi/( wi + p.invMass[j] );
+		glm::vec3 normal = d/dist;
+		dx += share*( thickness-dist )*normal;
+		float vn = dot( v - p.velocity(j), normal );
+		if( vn < 0 ) dv -= share*vn*normal;
+		return true;
+	}
+};
+
+#endif /* SelfCollision_hpp */
@@ -0,0 +1,111 @@
+//
+//  Simd.hpp
+//  SpringMass
+//
+//  The few vector operations the particle kernels need, on AVX (8 lanes),
+//  SSE2 or NEON (4 lanes), with a scalar fallback. Loads and stores are
+//  aligned: use FloatArray, whose storage is SIMD_ALIGN-byte aligned, and pad
+//  its length to a multiple of SIMD_PAD.
+//
+
+#ifndef Simd_hpp
+#define Simd_hpp
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_USE_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_USE_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_USE_NEON
+#endif
+
+const size_t SIMD_ALIGN = 64;
+const int SIMD_PAD = 8;			// array lengths are multiples of this, for any width
+
+template<typename T>
+struct AlignedAllocator {
+	typedef T value_type;
+	AlignedAllocator() = default;
+	template<typename U> AlignedAllocator( const AlignedAllocator<U>& ) {}
+	T* allocate( size_t n ) {
+		return (T*)::operator new( n*sizeof(T), std::align_val_t( SIMD_ALIGN ) );
+	}
+	void deallocate( T* p, size_t ) {
+		::operator delete( p, std::align_val_t( SIMD_ALIGN ) );
+	}
+	template<typename U> bool operator==( const AlignedAllocator<U>& ) const { return true; }
+	template<typename U> bool operator!=( const AlignedAllocator<U>& ) const { return false; }
+};
+typedef std::vector<float, AlignedAllocator<float>> FloatArray;
+
+struct SimdFloat {
+#if defined(SIMD_USE_AVX)
+	static const int WIDTH = 8;
+	__m256 v;
+	SimdFloat( __m256 a ) : v( a ) {}
+	explicit SimdFloat( float s ) : v( _mm256_set1_ps( s ) ) {}
+	static SimdFloat load( const float* p ) { return _mm256_load_ps( p ); }
+	void store( float* p ) const { _mm256_store_ps( p, v ); }
+	friend SimdFloat operator+( SimdFloat a, SimdFloat b ) { return _mm256_add_ps( a.v, b.v ); }
+	friend SimdFloat operator-( SimdFloat a, SimdFloat b ) { return _mm256_sub_ps( a.v, b.v ); }
+	friend SimdFloat operator*( SimdFloat a, SimdFloat b ) { return _mm256_mul_ps( a.v, b.v ); }
+	friend SimdFloat min( SimdFloat a, SimdFloat b ) { return _mm256_min_ps( a.v, b.v ); }
+	friend SimdFloat max( SimdFloat a, SimdFloat b ) { return _mm256_max_ps( a.v, b.v ); }
+	// bit i set where lane i of a is less than that of b
+	friend int lessMask( SimdFloat a, SimdFloat b ) { return _mm256_movemask_ps( _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ) ); }
+#elif defined(SIMD_USE_SSE)
+	static const int WIDTH = 4;
+	__m128 v;
+	SimdFloat( __m128 a ) : v( a ) {}
+	explicit SimdFloat( float s ) : v( _mm_set1_ps( s ) ) {}
+	static SimdFloat load( const float* p ) { return _mm_load_ps( p ); }
+	void store( float* p ) const { _mm_store_ps( p, v ); }
+	friend SimdFloat operator+( SimdFloat a, SimdFloat b ) { return _mm_add_ps( a.v, b.v ); }
+	friend SimdFloat operator-( SimdFloat a, SimdFloat b ) { return _mm_sub_ps( a.v, b.v ); }
+	friend SimdFloat operator*( SimdFloat a, SimdFloat b ) { return _mm_mul_ps( a.v, b.v ); }
+	friend SimdFloat min( SimdFloat a, SimdFloat b ) { return _mm_min_ps( a.v, b.v ); }
+	friend SimdFloat max( SimdFloat a, SimdFloat b ) { return _mm_max_ps( a.v, b.v ); }
+	friend int lessMask( SimdFloat a, SimdFloat b ) { return _mm_movemask_ps( _mm_cmplt_ps( a.v, b.v ) ); }
+#elif defined(SIMD_USE_NEON)
+	static const int WIDTH = 4;
+	float32x4_t v;
+	SimdFloat( float32x4_t a ) : v( a ) {}
+	explicit SimdFloat( float s ) : v( vdupq_n_f32( s ) ) {}
+	static SimdFloat load( const float* p ) { return vld1q_f32( p ); }
+	void store( float* p ) const { vst1q_f32( p, v ); }
+	friend SimdFloat operator+( SimdFloat a, SimdFloat b ) { return vaddq_f32( a.v, b.v ); }
+	friend SimdFloat operator-( SimdFloat a, SimdFloat b ) { return vsubq_f32( a.v, b.v ); }
+	friend SimdFloat operator*( SimdFloat a, SimdFloat b ) { return vmulq_f32( a.v, b.v ); }
+	friend SimdFloat min( SimdFloat a, SimdFloat b ) { return vminq_f32( a.v, b.v ); }
+	friend SimdFloat max( SimdFloat a, SimdFloat b ) { return vmaxq_f32( a.v, b.v ); }
+	friend int lessMask( SimdFloat a, SimdFloat b ) {
+		uint32x4_t m = vcltq_f32( a.v, b.v );
+		return ( vgetq_lane_u32( m, 0 )&1 ) | ( vgetq_lane_u32( m, 1 )&2 ) | ( vgetq_lane_u32( m, 2 )&4 ) | ( vgetq_lane_u32( m, 3 )&8 );
+	}
+#else
+	static const int WIDTH = 1;
+	float v;
+	explicit SimdFloat( float s ) : v( s ) {}
+	static SimdFloat load( const float* p ) { return SimdFloat( *p ); }
+	void store( float* p ) const { *p = v; }
+	friend SimdFloat operator+( SimdFloat a, SimdFloat b ) { return SimdFloat( a.v+b.v ); }
+	friend SimdFloat operator-( SimdFloat a, SimdFloat b ) { return SimdFloat( a.v-b.v ); }
+	friend SimdFloat operator*( SimdFloat a, SimdFloat b ) { return SimdFloat( a.v*b.v ); }
+	friend SimdFloat min( SimdFloat a, SimdFloat b ) { return SimdFloat( a.v<b.v ? a.v : b.v ); }
+	friend SimdFloat max( SimdFloat a, SimdFloat b ) { return SimdFloat( a.v<b.v ? b.v : a.v ); }
+	friend int lessMask( SimdFloat a, SimdFloat b ) { return a.v<b.v ? 1 : 0; }
+#endif
+};
+
+static inline int simdPadded( int n ) {
+	return ( n+SIMD_PAD-1 )/SIMD_PAD*SIMD_PAD;
+}
+
+#endif /* Simd_hpp */
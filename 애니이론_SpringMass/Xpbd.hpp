@@ -0,0 +1,178 @@
+//
+//  Xpbd.hpp
+//  SpringMass
+//
+//  Extended position-based dynamics (Macklin, Müller & Chentanez 2016) for
+//  the cloth. Every spring is a distance constraint with compliance 1/k:
+//  a substep predicts positions from gravity and drag, projects the
+//  constraints a number of times, and takes the velocities from the
+//  distance moved. With the Lagrange multipliers carried over the
+//  iterations, the stiffness no longer depends on the substep or the
+//  iteration count, only the convergence does, so substeps can be traded
+//  for iterations within one per-frame budget.
+//  Constraints are projected by colored Gauss-Seidel (the springs of one
+//  Springs::buildColors() color share no particle, so each color runs in
+//  parallel) or by Jacobi iterations that gather the corrections per
+//  particle over the CSR adjacency, averaged and over-relaxed. Collisions
+//  are position constraints: the collide(x, v) of Particles::integrate()
+//  first sees each predicted position with the velocity of the path to it,
+//  so that swept tests stop particles before a thin collider rather than
+//  behind it, then projects x after every iteration (v is 0 there, a path
+//  of no length), and is called once more on the final velocities for
+//  restitution and friction. Spring damping kd is not used.
+//
+
+#ifndef Xpbd_hpp
+#define Xpbd_hpp
+
+#include <chrono>
+#include "Cloth.hpp"
+
+struct XpbdStats {
+	int substeps = 0;
+	int iterations = 0;			// in the whole frame
+	float maxStrain = 0;		// |len - L|/L after the last iteration
+	float rmsStrain = 0;
+	double milliseconds = 0;
+};
+
+struct XpbdSolver {
+	int budget = 40;			// constraint iterations per frame, over all substeps
+	int substeps = 4;
+	bool jacobi = false;		// Jacobi instead of colored Gauss-Seidel
+	float relaxation = 1.5f;	// Jacobi over-relaxation of the averaged corrections
+	XpbdStats stats;			// of the last frame
+
+	int iterationsPerSubstep() const { return std::max( 1, budget/std::max( 1, substeps ) ); }
+
+	// Advances one frame of length dt. Particles in `fixed` have infinite
+	// mass. Springs need buildColors() for Gauss-Seidel to run in parallel,
+	// and an adjacency for Jacobi.
+	template<typename Collide>
+	void frame( Particles& p, const Springs& s, const glm::vec3& g, float kDrag, float dt,
+			   const std::vector<int>& fixed, Collide collide ) {
+		auto t0 = std::chrono::steady_clock::now();
+		const int n = p.count, steps = std::max( 1, substeps ), iterations = iterationsPerSubstep();
+		const float h = dt/steps;
+		prev.resize( n );
+		lambda.resize( s.count() );
+		correction.resize( s.count() );
+		w.assign( p.invMass.begin(), p.invMass.begin()+n );
+		for( int i: fixed ) w[i] = 0;
+
+		for( int step=0; step<steps; step++ ) {
+			for( int i=0; i<n; i++ ) prev[i] = p.position(i);
+			p.integrate( g, kDrag, h, []( glm::vec3&, glm::vec3& ) {} );
+			for( int i: fixed ) {
+				p.setPosition( i, prev[i] );
+				p.setVelocity( i, glm::vec3( 0 ) );
+			}
+			parallelFor( 0, n, [&]( int b, int e ) {
+				for( int i=b; i<e; i++ ) {
+					if( w[i] == 0 ) continue;
+					glm::vec3 x = p.position(i), v = ( x-prev[i] )/h;
+					collide( x, v );
+					p.setPosition( i, x );
+				}
+			}, 1024 );
+			std::fill( lambda.begin(), lambda.end(), 0.f );
+			const float alphaTilde = 1/( h*h );		// times 1/k per spring
+			for( int it=0; it<iterations; it++ ) {
+				if( jacobi && (int)s.adjStart.size() == n+1 )
+					solveJacobi( p, s, alphaTilde );
+				else if( s.colors() > 0 && s.colorStart.back() == s.count() ) {
+					for( int c=0; c<s.colors(); c++ ) {
+						if( c == Springs::MAX_COLORS )
+							solve( p, s, alphaTilde, s.colorStart[c], s.colorStart[c+1] );
+						else
+							parallelFor( s.colorStart[c], s.colorStart[c+1], [&]( int b, int e ) {
+								solve( p, s, alphaTilde, b, e );
+							}, 1024 );
+					}
+				}
+				else
+					solve( p, s, alphaTilde, 0, s.count() );
+				parallelFor( 0, n, [&]( int b, int e ) {
+					for( int i=b; i<e; i++ ) {
+						if( w[i] == 0 ) continue;
+						glm::vec3 x = p.position(i), v( 0 );
+						collide( x, v );
+						p.setPosition( i, x );
+					}
+				}, 1024 );
+			}
+			parallelFor( 0, n, [&]( int b, int e ) {
+				for( int i=b; i<e; i++ ) {
+					if( w[i] == 0 ) continue;
+					glm::vec3 x = p.position(i), v = ( x-prev[i] )/h;
+					collide( x, v );
+					p.setPosition( i, x );
+					p.setVelocity( i, v );
+				}
+			}, 1024 );
+		}
+
+		stats.substeps = steps;
+		stats.iterations = steps*iterations;
+		stats.maxStrain = 0;
+		double sum = 0;
+		for( int i=0; i<s.count(); i++ ) {
+			float strain = fabsf( length( p.position(s.a[i])-p.position(s.b[i]) )/s.restLength[i] - 1 );
+			stats.maxStrain = std::max( stats.maxStrain, strain );
+			sum += strain*strain;
+		}
+		stats.rmsStrain = s.count() ? float( sqrt( sum/s.count() ) ) : 0;
+		stats.milliseconds = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now()-t0 ).count();
+	}
+
+private:
+	std::vector<glm::vec3> prev;
+	std::vector<glm::vec3> correction;		// per spring, Jacobi
+	std::vector<float> lambda, w;
+
+	// Multiplier change of spring i; sets its gradient n (unit, from b to a).
+	float deltaLambda( const Particles& p, const Springs& s, float alphaTilde, int i, glm::vec3& n ) const {
+		glm::vec3 dx = p.position(s.a[i]) - p.position(s.b[i]);
+		float len = length( dx );
+		float wSum = w[s.a[i]] + w[s.b[i]];
+		if( len < 1e-9f || wSum == 0 ) return 0;
+		n = dx/len;
+		float alpha = alphaTilde/s.k[i];
+		return ( s.restLength[i] - len - alpha*lambda[i] )/( wSum + alpha );
+	}
+	// Gauss-Seidel over springs [b,e), which must not share particles when
+	// run concurrently.
+	void solve( Particles& p, const Springs& s, float alphaTilde, int b, int e ) {
+		for( int i=b; i<e; i++ ) {
+			glm::vec3 n( 0 );
+			float dl = deltaLambda( p, s, alphaTilde, i, n );
+			lambda[i] += dl;
+			p.setPosition( s.a[i], p.position(s.a[i]) + w[s.a[i]]*dl*n );
+			p.setPosition( s.b[i], p.position(s.b[i]) - w[s.b[i]]*dl*n );
+		}
+	}
+	void solveJacobi( Particles& p, const Springs& s, float alphaTilde ) {
+		parallelFor( 0, s.count(), [&]( int b, int e ) {
+			for( int i=b; i<e; i++ ) {
+				glm::vec3 n( 0 );
+				float dl = deltaLambda( p, s, alphaTilde, i, n );
+				lambda[i] += dl;
+				correction[i] = dl*n;
+			}
+		}, 2048 );
+		parallelFor( 0, p.count, [&]( int b, int e ) {
+			for( int j=b; j<e; j++ ) {
+				int degree = s.adjStart[j+1]-s.adjStart[j];
+				if( w[j] == 0 || degree == 0 ) continue;
+				glm::vec3 sum( 0 );
+				for( int k=s.adjStart[j]; k<s.adjStart[j+1]; k++ ) {
+					int i = s.adjSpring[k];
+					sum += s.a[i] == j ? correction[i] : -correction[i];
+				}
+				p.setPosition( j, p.position(j) + relaxation/degree*w[j]*sum );
+			}
+		}, 1024 );
+	}
+};
+
+#endif /* Xpbd_hpp */
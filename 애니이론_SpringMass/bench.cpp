@@ -0,0 +1,798 @@
+//
+//  bench.cpp
+//  SpringMass
+//
+//  Substep throughput of the cloth solver on square grids of particles laid
+//  out like init() in main.cpp. The reference is the original array-of-
+//  structs code (one pass per force, one per collider); "soa" is Cloth.hpp
+//  with Morton-ordered particles. max_dx is the largest position difference
+//  from the reference after the run.
+//  A second table times the spring forces alone, in grid order and with
+//  particles and springs shuffled as they may come from a mesh file: the
+//  reference springs, the index/CSR springs, and those after reorderMorton(),
+//  also with the z jitter of init() in main.cpp. span is the mean index
+//  distance between spring endpoints after reorderMorton().
+//  The scaling table runs the three SpringEvaluation modes on the largest
+//  grid for each thread count, with the largest force difference from the
+//  serial loop relative to the largest force.
+//  The last table hangs a cloth by its top corners for one second of frames
+//  at increasing spring stiffness, and finds the fewest substeps per frame
+//  at which explicit Euler (doubling from 1) and ImplicitEuler (1, 2, 4) stay
+//  stable: finite, inside the scene and slower than 2000 units/s at the end.
+//  Speedup compares the frame times at those substep counts.
+//  The XPBD table hangs the same cloth with the frame's iteration budget
+//  split into more or fewer substeps, colored Gauss-Seidel and Jacobi, and
+//  reports the time per frame and the strain left at the end.
+//  The self-collision table folds square grids into an accordion whose
+//  layers lie closer than the thickness, and times SelfCollision::resolve()
+//  (hash build included) against one explicit substep of the same cloth.
+//  The collider table scatters particles and 1 to 1000 random spheres,
+//  capsules and boxes over a slab above the floor, and times one collision
+//  pass of every particle against every collider against ColliderSet's grid
+//  and SIMD bounds, with the pairs tested and the largest difference.
+//  The mesh table writes a bumpy sphere of about 100k triangles to an OBJ
+//  file, loads it into a MeshCollider, and times the load, the BVH build,
+//  and one resolve() of particles scattered around the surface for each
+//  thread count; brute force checks the BVH's closest points on a sample.
+//  The SDF table bakes the same sphere at 1/100, 1/10 and all of those
+//  triangles into an SdfCollider, moves both colliders (and the particles)
+//  by one rotation and translation, and compares one resolve() against the
+//  MeshCollider's, in time and in the largest position difference. The
+//  mesh's depth is raised to push out every particle, as the SDF does.
+//  The tunneling table drops particles fast onto a thin box, a small
+//  sphere, a two-triangle mesh plate and the SDF of a thin box for half a
+//  second at 1 to 100 substeps per frame, and counts those that end up
+//  straight beyond it, with the discrete tests alone and with
+//  sweepParticles() before them. The particles start far outside the
+//  SDF's grid and cross all of it in one substep at the lowest counts.
+//  Tables go to stderr, one JSON record per grid and per thread count to
+//  stdout (or to the file given with --out).
+//
+//  usage: bench [--sizes 20,100,300] [--substeps N] [--reps N]
+//               [--threads 1,2,4,8,16,32] [--implicit-grid N]
+//               [--stiffness 4.8,480,48000] [--xpbd-budget N]
+//               [--self-sizes 100,320] [--colliders 1,10,100,1000]
+//               [--collider-particles N] [--mesh-triangles N]
+//               [--sdf-cell F] [--tunnel-speed F] [--out results.json]
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Implicit.hpp"
+#include "Xpbd.hpp"
+#include "SelfCollision.hpp"
+#include "Colliders.hpp"
+#include "SdfCollider.hpp"
+
+using namespace glm;
+
+namespace reference {
+
+struct Particle {
+	vec3 x;
+	vec3 v;
+	vec3 f;
+	float m;
+	Particle(float mass, const vec3& position, const vec3& velocity = vec3(0))
+		: x(position), v(velocity), m(mass) {}
+	void clearForce() { f = vec3(0); }
+	void add(const vec3& force) { f += force; }
+	void update(float deltaT) {
+		v += f / m * deltaT;
+		x += v * deltaT;
+	}
+};
+
+struct Spring {
+	Particle& a;
+	Particle& b;
+	float restLength;
+	float k = 4.8f;
+	float kd = 0.0f;
+	Spring(Particle& x, Particle& y) : a(x), b(y), restLength(length(x.x - y.x)) {}
+	void addForce() {
+		vec3 dx = a.x - b.x;
+		vec3 dx_ = normalize(dx);
+		vec3 dv = a.v - b.v;
+		vec3 f = (k * (length(dx) - restLength) + kd * dot(dv, dx_)) * dx_;
+		a.add(-f);
+		b.add(f);
+	}
+};
+
+} // namespace reference
+
+const vec3 G(0, -980.f, 0);
+const float k_drag = 0.01f;
+const float MASS = 0.001f;
+const float SPACING = 2.f;
+
+static vec3 gridPosition(int x, int y) {
+	return vec3(x * SPACING - 18.f, y * SPACING + 70, 0);
+}
+
+// The four spring families of main.cpp's init(), as index pairs.
+static std::vector<std::pair<int, int>> gridSprings(int n) {
+	std::vector<std::pair<int, int>> s;
+	for (int y = 0; y < n - 1; ++y) for (int x = 0; x < n; ++x) s.push_back({ y * n + x, (y + 1) * n + x });
+	for (int y = 0; y < n; ++y) for (int x = 0; x < n - 1; ++x) s.push_back({ y * n + x, y * n + x + 1 });
+	for (int y = 0; y < n - 1; ++y) for (int x = 0; x < n - 1; ++x) s.push_back({ y * n + x, (y + 1) * n + x + 1 });
+	for (int y = 0; y < n - 1; ++y) for (int x = 0; x < n - 1; ++x) s.push_back({ (y + 1) * n + x, y * n + x + 1 });
+	return s;
+}
+
+// Latitude rings x longitudes x 2 triangles, radius 30 with bumps of 2,
+// centered 40 above the floor.
+static TriangleMesh bumpySphere(int triangles) {
+	const int rings = std::max(4, (int)sqrtf(triangles / 4.f)), slices = 2 * rings;
+	TriangleMesh mesh;
+	for (int i = 0; i <= rings; i++) for (int j = 0; j < slices; j++) {
+		float theta = 3.14159265f * i / rings, phi = 6.2831853f * j / slices;
+		float r = 30 + 2 * sinf(5 * theta) * sinf(7 * phi);
+		mesh.vertices.push_back(vec3(r * sinf(theta) * cosf(phi), r * cosf(theta) + 40, r * sinf(theta) * sinf(phi)));
+	}
+	for (int i = 0; i < rings; i++) for (int j = 0; j < slices; j++) {
+		unsigned a = i * slices + j, b = i * slices + (j + 1) % slices;
+		mesh.faces.push_back(uvec3(a, b + slices, a + slices));
+		mesh.faces.push_back(uvec3(a, b, b + slices));
+	}
+	return mesh;
+}
+
+// Particles falling onto bumpySphere() from a shell 6 deep on either side
+// of its surface, in Morton order.
+static Particles aroundSphere(int n) {
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> u(0, 1);
+	Particles ps;
+	Springs none;
+	for (int i = 0; i < n; i++) {
+		vec3 d = normalize(vec3(u(rng), u(rng), u(rng)) - vec3(.5f));
+		ps.add(MASS, vec3(0, 40, 0) + d * (26 + 10 * u(rng)), d * -100.f);
+	}
+	reorderMorton(ps, none);
+	return ps;
+}
+
+static double seconds(std::chrono::steady_clock::time_point a, std::chrono::steady_clock::time_point b) {
+	return std::chrono::duration<double>(b - a).count();
+}
+
+static std::vector<int> parseList(const std::string& s) {
+	std::vector<int> r;
+	std::stringstream ss(s);
+	std::string tok;
+	while (std::getline(ss, tok, ','))
+		r.push_back(atoi(tok.c_str()));
+	return r;
+}
+
+int main(int argc, const char* argv[]) {
+	std::vector<int> sizes = { 20, 100, 300 };
+	int substeps = 200;
+	int reps = 3;
+	std::vector<int> threadCounts = { 1, 2, 4, 8, 16, 32 };
+	int implicitGrid = 40;
+	std::vector<float> stiffnesses = { 4.8f, 480, 48000 };
+	int xpbdBudget = 40;
+	std::vector<int> selfSizes = { 100, 320 };
+	std::vector<int> colliderCounts = { 1, 10, 100, 1000 };
+	int colliderParticles = 90000;
+	int meshTriangles = 100000;
+	float sdfCell = 1;
+	float tunnelSpeed = 500;
+	std::string outFn;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		std::string a = argv[i];
+		if (a == "--sizes") sizes = parseList(argv[i + 1]);
+		else if (a == "--substeps") substeps = atoi(argv[i + 1]);
+		else if (a == "--reps") reps = atoi(argv[i + 1]);
+		else if (a == "--threads") threadCounts = parseList(argv[i + 1]);
+		else if (a == "--implicit-grid") implicitGrid = atoi(argv[i + 1]);
+		else if (a == "--stiffness") {
+			stiffnesses.clear();
+			std::stringstream ss(argv[i + 1]);
+			std::string tok;
+			while (std::getline(ss, tok, ','))
+				stiffnesses.push_back((float)atof(tok.c_str()));
+		}
+		else if (a == "--xpbd-budget") xpbdBudget = atoi(argv[i + 1]);
+		else if (a == "--self-sizes") selfSizes = parseList(argv[i + 1]);
+		else if (a == "--colliders") colliderCounts = parseList(argv[i + 1]);
+		else if (a == "--collider-particles") colliderParticles = atoi(argv[i + 1]);
+		else if (a == "--mesh-triangles") meshTriangles = atoi(argv[i + 1]);
+		else if (a == "--sdf-cell") sdfCell = (float)atof(argv[i + 1]);
+		else if (a == "--tunnel-speed") tunnelSpeed = (float)atof(argv[i + 1]);
+		else if (a == "--out") outFn = argv[i + 1];
+		else {
+			std::cerr << "[ERROR] Unknown option: " << a << std::endl;
+			return 1;
+		}
+	}
+	std::ofstream outFile;
+	if (!outFn.empty()) outFile.open(outFn);
+	std::ostream& out = outFn.empty() ? std::cout : outFile;
+
+	const float h = 1 / 60.f / 100;
+	const Plane flooring({ 0, 0, 0 }, { 0, 1, 0 });
+	const Sphere sphere({ 0, 30, -5 }, 30.f);
+
+	std::vector<std::string> records;
+	fprintf(stderr, "%8s %8s %8s %14s %14s %8s %10s\n", "grid", "springs", "substeps", "ref Mp-sub/s", "soa Mp-sub/s", "speedup", "max_dx");
+	for (int n : sizes) {
+		auto pairs = gridSprings(n);
+		double refTime = 1e30, soaTime = 1e30;
+		std::vector<reference::Particle> refParticles;
+		Particles particles;
+
+		for (int r = 0; r < reps; r++) {
+			refParticles.clear();
+			for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+				refParticles.emplace_back(MASS, gridPosition(x, y));
+			std::vector<reference::Spring> springs;
+			for (auto& p : pairs) springs.emplace_back(refParticles[p.first], refParticles[p.second]);
+
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; i < substeps; i++) {
+				for (auto& p : refParticles) p.clearForce();
+				for (auto& s : springs) s.addForce();
+				for (auto& p : refParticles) p.add(p.m * G);
+				for (auto& p : refParticles) p.add(-k_drag * p.v);
+				for (auto& p : refParticles) p.update(h);
+				for (auto& p : refParticles) flooring.resolveCollision(p.x, p.v);
+				for (auto& p : refParticles) sphere.resolveCollision(p.x, p.v);
+			}
+			auto t1 = std::chrono::steady_clock::now();
+			refTime = std::min(refTime, seconds(t0, t1));
+		}
+
+		std::vector<int> newIndex;
+		for (int r = 0; r < reps; r++) {
+			particles.clear();
+			for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+				particles.add(MASS, gridPosition(x, y));
+			Springs springs;
+			for (auto& p : pairs) springs.add(particles, p.first, p.second);
+			newIndex = reorderMorton(particles, springs);
+
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; i < substeps; i++) {
+				springs.addForces(particles);
+				particles.integrate(G, k_drag, h, [&](vec3& x, vec3& v) {
+					flooring.resolveCollision(x, v);
+					sphere.resolveCollision(x, v);
+				});
+			}
+			auto t1 = std::chrono::steady_clock::now();
+			soaTime = std::min(soaTime, seconds(t0, t1));
+		}
+
+		float maxDx = 0;
+		for (int i = 0; i < particles.count; i++)
+			maxDx = std::max(maxDx, length(particles.position(newIndex[i]) - refParticles[i].x));
+		double work = (double)n * n * substeps / 1e6;
+		fprintf(stderr, "%8s %8d %8d %14.2f %14.2f %8.2f %10.3g\n", (std::to_string(n) + "^2").c_str(),
+			(int)pairs.size(), substeps, work / refTime, work / soaTime, refTime / soaTime, maxDx);
+		std::ostringstream rec;
+		rec << "{\"grid\":" << n << ",\"particles\":" << n * n << ",\"springs\":" << pairs.size()
+			<< ",\"substeps\":" << substeps << ",\"simd_width\":" << SimdFloat::WIDTH
+			<< ",\"ref_s\":" << refTime << ",\"soa_s\":" << soaTime
+			<< ",\"ref_particle_substeps_per_s\":" << work * 1e6 / refTime
+			<< ",\"soa_particle_substeps_per_s\":" << work * 1e6 / soaTime
+			<< ",\"max_dx\":" << maxDx;
+		records.push_back(rec.str());
+	}
+
+	fprintf(stderr, "\nspring forces, M springs/s\n%8s %8s %10s %10s %10s %10s %10s %10s %8s %8s\n", "grid", "springs",
+		"ref grid", "ref shuf", "csr grid", "csr shuf", "csr morton", "morton jit", "span", "span jit");
+	for (size_t si = 0; si < sizes.size(); si++) {
+		int n = sizes[si];
+		auto pairs = gridSprings(n);
+		std::vector<int> perm(n * n);
+		std::iota(perm.begin(), perm.end(), 0);
+		std::mt19937 rng(1234);
+		std::shuffle(perm.begin(), perm.end(), rng);
+		auto shuffled = pairs;
+		for (auto& p : shuffled) p = { perm[p.first], perm[p.second] };
+		std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+		auto timeRef = [&](const std::vector<std::pair<int, int>>& topology, bool shuffle) {
+			std::vector<reference::Particle> ps(n * n, reference::Particle(MASS, vec3(0)));
+			for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+				ps[shuffle ? perm[y * n + x] : y * n + x].x = gridPosition(x, y);
+			std::vector<reference::Spring> springs;
+			for (auto& p : topology) springs.emplace_back(ps[p.first], ps[p.second]);
+			double best = 1e30;
+			for (int r = 0; r < reps; r++) {
+				auto t0 = std::chrono::steady_clock::now();
+				for (int i = 0; i < substeps; i++)
+					for (auto& s : springs) s.addForce();
+				best = std::min(best, seconds(t0, std::chrono::steady_clock::now()));
+			}
+			return best;
+		};
+		double span = 0;
+		auto timeCsr = [&](const std::vector<std::pair<int, int>>& topology, bool shuffle, bool morton, bool jitter = false) {
+			std::vector<vec3> pos(n * n);
+			for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+				pos[shuffle ? perm[y * n + x] : y * n + x] = gridPosition(x, y) + vec3(0, 0, jitter ? rng() / (float)rng.max() * 0.001f : 0);
+			Particles ps;
+			for (auto& x : pos) ps.add(MASS, x);
+			Springs springs;
+			for (auto& p : topology) springs.add(ps, p.first, p.second);
+			if (morton) {
+				reorderMorton(ps, springs);
+				span = 0;
+				for (int i = 0; i < springs.count(); i++) span += std::abs(springs.a[i] - springs.b[i]);
+				span /= std::max(springs.count(), 1);
+			}
+			double best = 1e30;
+			for (int r = 0; r < reps; r++) {
+				auto t0 = std::chrono::steady_clock::now();
+				for (int i = 0; i < substeps; i++)
+					springs.addForces(ps);
+				best = std::min(best, seconds(t0, std::chrono::steady_clock::now()));
+			}
+			return best;
+		};
+		double t[6] = { timeRef(pairs, false), timeRef(shuffled, true),
+			timeCsr(pairs, false, false), timeCsr(shuffled, true, false), timeCsr(shuffled, true, true), 0 };
+		double flatSpan = span;
+		t[5] = timeCsr(shuffled, true, true, true);
+		double work = (double)pairs.size() * substeps / 1e6;
+		fprintf(stderr, "%8s %8d %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f %8.1f %8.1f\n", (std::to_string(n) + "^2").c_str(),
+			(int)pairs.size(), work / t[0], work / t[1], work / t[2], work / t[3], work / t[4], work / t[5], flatSpan, span);
+		out << records[si] << ",\"springs_per_s\":{\"ref_grid\":" << work * 1e6 / t[0]
+			<< ",\"ref_shuffled\":" << work * 1e6 / t[1] << ",\"csr_grid\":" << work * 1e6 / t[2]
+			<< ",\"csr_shuffled\":" << work * 1e6 / t[3] << ",\"csr_morton\":" << work * 1e6 / t[4]
+			<< ",\"csr_morton_jitter\":" << work * 1e6 / t[5] << "},\"spring_span\":" << flatSpan
+			<< ",\"spring_span_jitter\":" << span << "}" << std::endl;
+	}
+
+	int n = *std::max_element(sizes.begin(), sizes.end());
+	Particles particles;
+	for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+		particles.add(MASS, gridPosition(x, y));
+	Springs springs;
+	for (auto& p : gridSprings(n)) springs.add(particles, p.first, p.second);
+	for (int i = 0; i < particles.count; i++)		// stretch the springs a little
+		particles.setPosition(i, particles.position(i) + vec3(0, 0, 0.1f * sinf(i * 0.37f)));
+	reorderMorton(particles, springs);
+	springs.buildColors(particles.count);
+	auto evaluate = [&](SpringEvaluation mode) {
+		std::fill(particles.fx.begin(), particles.fx.end(), 0.f);
+		std::fill(particles.fy.begin(), particles.fy.end(), 0.f);
+		std::fill(particles.fz.begin(), particles.fz.end(), 0.f);
+		springs.addForces(particles, mode);
+	};
+	evaluate(SPRINGS_SERIAL);
+	std::vector<vec3> serialForce(particles.count);
+	float maxForce = 0;
+	for (int i = 0; i < particles.count; i++) {
+		serialForce[i] = vec3(particles.fx[i], particles.fy[i], particles.fz[i]);
+		maxForce = std::max(maxForce, length(serialForce[i]));
+	}
+	auto timeMode = [&](SpringEvaluation mode, float& error) {
+		double best = 1e30;
+		for (int r = 0; r < reps; r++) {
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; i < substeps; i++)
+				evaluate(mode);
+			best = std::min(best, seconds(t0, std::chrono::steady_clock::now()));
+		}
+		error = 0;
+		for (int i = 0; i < particles.count; i++)
+			error = std::max(error, length(vec3(particles.fx[i], particles.fy[i], particles.fz[i]) - serialForce[i]));
+		error /= std::max(maxForce, 1e-30f);
+		return best;
+	};
+	fprintf(stderr, "\nspring force scaling on %d^2 (%d springs, %d colors, %u hardware threads), M springs/s\n%8s %10s %10s %10s %12s %12s\n",
+		n, springs.count(), springs.colors(), std::thread::hardware_concurrency(),
+		"threads", "serial", "colored", "gathered", "colored err", "gathered err");
+	for (int t : threadCounts) {
+		setParallelThreads(t);
+		float serialErr, coloredErr, gatheredErr;
+		double ts = timeMode(SPRINGS_SERIAL, serialErr);
+		double tc = timeMode(SPRINGS_COLORED, coloredErr);
+		double tg = timeMode(SPRINGS_GATHERED, gatheredErr);
+		double work = (double)springs.count() * substeps / 1e6;
+		fprintf(stderr, "%8d %10.2f %10.2f %10.2f %12.3g %12.3g\n", t, work / ts, work / tc, work / tg, coloredErr, gatheredErr);
+		out << "{\"scaling_grid\":" << n << ",\"threads\":" << t << ",\"colors\":" << springs.colors()
+			<< ",\"springs_per_s\":{\"serial\":" << work * 1e6 / ts << ",\"colored\":" << work * 1e6 / tc
+			<< ",\"gathered\":" << work * 1e6 / tg << "},\"colored_rel_err\":" << coloredErr
+			<< ",\"gathered_rel_err\":" << gatheredErr << "}" << std::endl;
+	}
+	setParallelThreads(0);
+
+	// One second of a hanging cloth; returns the time per frame, or a negative
+	// value if the run blew up.
+	const int FRAMES = 60;
+	auto collide = [&](vec3& x, vec3& v) {
+		flooring.resolveCollision(x, v);
+		sphere.resolveCollision(x, v);
+	};
+	auto hangingCloth = [&](float k, Particles& ps, Springs& ss) {
+		int n = implicitGrid;
+		for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x)
+			ps.add(MASS, gridPosition(x, y));
+		for (auto& p : gridSprings(n)) ss.add(ps, p.first, p.second, k);
+		auto newIndex = reorderMorton(ps, ss);
+		ss.buildColors(ps.count);
+		return std::vector<int>{ newIndex[(n - 1) * n], newIndex[n * n - 1] };
+	};
+	auto hang = [&](float k, int steps, bool useImplicit, float& cgIterations) {
+		Particles ps;
+		Springs ss;
+		std::vector<int> fixed = hangingCloth(k, ps, ss);
+		std::vector<vec3> pinned = { ps.position(fixed[0]), ps.position(fixed[1]) };
+		ImplicitEuler implicit;
+		const float dt = 1 / 60.f / steps;
+		long totalIterations = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (int i = 0; i < FRAMES * steps; i++) {
+			if (useImplicit) {
+				implicit.step(ps, ss, SPRINGS_COLORED, G, k_drag, dt, fixed, collide);
+				totalIterations += implicit.iterations;
+			}
+			else {
+				ss.addForces(ps, SPRINGS_COLORED);
+				ps.integrate(G, k_drag, dt, collide);
+			}
+			for (int j = 0; j < 2; j++) {
+				ps.setPosition(fixed[j], pinned[j]);
+				ps.setVelocity(fixed[j], vec3(0));
+			}
+		}
+		double t = seconds(t0, std::chrono::steady_clock::now()) / FRAMES;
+		cgIterations = useImplicit ? (float)totalIterations / (FRAMES * steps) : 0;
+		for (int i = 0; i < ps.count; i++) {
+			vec3 x = ps.position(i);
+			if (!(std::isfinite(x.x) && std::isfinite(x.y) && std::isfinite(x.z)) || length(x) > 1000
+				|| !(length(ps.velocity(i)) < 2000)) return -1.0;
+		}
+		return t;
+	};
+	fprintf(stderr, "\nhanging %d^2 cloth, fewest stable substeps per frame\n%8s %10s %12s %10s %12s %8s %8s\n",
+		implicitGrid, "k", "explicit", "ms/frame", "implicit", "ms/frame", "CG its", "speedup");
+	for (float k : stiffnesses) {
+		int explicitSteps = 0, implicitSteps = 0;
+		double explicitTime = -1, implicitTime = -1;
+		float iterations = 0, unused;
+		for (int steps = 1; steps <= 8192 && explicitTime < 0; steps *= 2)
+			if ((explicitTime = hang(k, steps, false, unused)) >= 0) explicitSteps = steps;
+		for (int steps = 1; steps <= 4 && implicitTime < 0; steps *= 2)
+			if ((implicitTime = hang(k, steps, true, iterations)) >= 0) implicitSteps = steps;
+		auto column = [](int steps, double t) {
+			char buf[64];
+			if (steps) snprintf(buf, sizeof buf, "%10d %12.3f", steps, t * 1e3);
+			else snprintf(buf, sizeof buf, "%10s %12s", "-", "-");
+			return std::string(buf);
+		};
+		fprintf(stderr, "%8g %s %s %8.1f %8.2f\n", k, column(explicitSteps, explicitTime).c_str(),
+			column(implicitSteps, implicitTime).c_str(), iterations,
+			explicitSteps && implicitSteps ? explicitTime / implicitTime : 0.0);
+		out << "{\"implicit_grid\":" << implicitGrid << ",\"k\":" << k
+			<< ",\"explicit_substeps\":" << explicitSteps << ",\"explicit_s_per_frame\":" << explicitTime
+			<< ",\"implicit_substeps\":" << implicitSteps << ",\"implicit_s_per_frame\":" << implicitTime
+			<< ",\"cg_iterations\":" << iterations << "}" << std::endl;
+	}
+
+	const float xpbdK = 480;
+	fprintf(stderr, "\nxpbd, hanging %d^2 cloth, k=%g, %d iterations per frame, rms strain\n%8s %10s %10s %10s %10s %10s\n",
+		implicitGrid, xpbdK, xpbdBudget, "substeps", "iters", "GS ms", "GS strain", "Jac ms", "Jac strain");
+	for (int steps = 1; steps <= xpbdBudget; steps *= 2) {
+		XpbdStats result[2];
+		for (int jacobi = 0; jacobi < 2; jacobi++) {
+			Particles ps;
+			Springs ss;
+			std::vector<int> fixed = hangingCloth(xpbdK, ps, ss);
+			XpbdSolver xpbd;
+			xpbd.budget = xpbdBudget;
+			xpbd.substeps = steps;
+			xpbd.jacobi = jacobi;
+			double total = 0;
+			for (int f = 0; f < FRAMES; f++) {
+				xpbd.frame(ps, ss, G, k_drag, 1 / 60.f, fixed, collide);
+				total += xpbd.stats.milliseconds;
+			}
+			result[jacobi] = xpbd.stats;
+			result[jacobi].milliseconds = total / FRAMES;
+		}
+		fprintf(stderr, "%8d %10d %10.3f %10.4f %10.3f %10.4f\n", steps, result[0].iterations / steps,
+			result[0].milliseconds, result[0].rmsStrain, result[1].milliseconds, result[1].rmsStrain);
+		out << "{\"xpbd_grid\":" << implicitGrid << ",\"k\":" << xpbdK << ",\"budget\":" << xpbdBudget
+			<< ",\"substeps\":" << steps << ",\"iterations_per_substep\":" << result[0].iterations / steps
+			<< ",\"gauss_seidel\":{\"ms_per_frame\":" << result[0].milliseconds << ",\"rms_strain\":" << result[0].rmsStrain
+			<< ",\"max_strain\":" << result[0].maxStrain << "},\"jacobi\":{\"ms_per_frame\":" << result[1].milliseconds
+			<< ",\"rms_strain\":" << result[1].rmsStrain << ",\"max_strain\":" << result[1].maxStrain << "}}" << std::endl;
+	}
+
+	fprintf(stderr, "\nself-collision on folded grids, ms per call\n%10s %10s %10s %10s %10s %10s %10s\n",
+		"particles", "contacts", "build", "resolve", "ns/part", "substep", "ratio");
+	for (int n : selfSizes) {
+		Particles ps;
+		Springs ss;
+		// every 8 columns the cloth turns back, one unit behind the previous layer
+		for (int y = 0; y < n; ++y) for (int x = 0; x < n; ++x) {
+			int layer = x / 8, u = layer % 2 ? 7 - x % 8 : x % 8;
+			ps.add(MASS, vec3(u * SPACING, y * SPACING + 70, (float)layer));
+		}
+		for (auto& p : gridSprings(n)) ss.add(ps, p.first, p.second);
+		reorderMorton(ps, ss);
+		ss.buildColors(ps.count);
+		SelfCollision self;
+		double build = 1e30, resolve = 1e30, substep = 1e30;
+		const int calls = std::max(1, 2000000 / ps.count);
+		for (int r = 0; r < reps; r++) {
+			Particles copy = ps;
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; i < calls; i++) self.hash.build(copy);
+			auto t1 = std::chrono::steady_clock::now();
+			for (int i = 0; i < calls; i++) self.resolve(copy, ss);
+			auto t2 = std::chrono::steady_clock::now();
+			for (int i = 0; i < calls; i++) {
+				ss.addForces(copy, SPRINGS_COLORED);
+				copy.integrate(G, k_drag, h, collide);
+			}
+			auto t3 = std::chrono::steady_clock::now();
+			build = std::min(build, seconds(t0, t1) / calls);
+			resolve = std::min(resolve, seconds(t1, t2) / calls);
+			substep = std::min(substep, seconds(t2, t3) / calls);
+		}
+		self.resolve(ps, ss);
+		fprintf(stderr, "%10d %10d %10.3f %10.3f %10.1f %10.3f %10.2f\n", ps.count, self.contacts, build * 1e3,
+			resolve * 1e3, resolve / ps.count * 1e9, substep * 1e3, resolve / substep);
+		out << "{\"self_collision_particles\":" << ps.count << ",\"contacts\":" << self.contacts
+			<< ",\"build_s\":" << build << ",\"resolve_s\":" << resolve << ",\"substep_s\":" << substep << "}" << std::endl;
+	}
+
+	fprintf(stderr, "\ncolliders, %d particles, ms per pass\n%10s %10s %12s %10s %10s %10s %10s %10s\n", colliderParticles,
+		"colliders", "contacts", "naive_tests", "naive", "tests", "grid", "speedup", "max_dx");
+	for (int nColliders : colliderCounts) {
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> u(0, 1);
+		auto inSlab = [&]() { return vec3(u(rng) * 200 - 100, u(rng) * 40, u(rng) * 200 - 100); };
+		Particles ps;
+		Springs none;
+		for (int i = 0; i < colliderParticles; i++)
+			ps.add(MASS, inSlab(), vec3(u(rng) - .5f, u(rng) - .5f, u(rng) - .5f) * 100.f);
+		reorderMorton(ps, none);
+		ColliderSet set;
+		set.planes.push_back(flooring);
+		for (int i = 0; i < nColliders; i++) {
+			vec3 c = inSlab();
+			float r = 1 + 3 * u(rng);
+			if (i % 3 == 0) set.spheres.push_back(Sphere(c, r));
+			else if (i % 3 == 1) set.capsules.push_back(Capsule(c, c + (vec3(u(rng), u(rng), u(rng)) - vec3(.5f)) * 4.f * r, r / 2));
+			else set.boxes.push_back(Box(c, vec3(u(rng), u(rng), u(rng)) * r + vec3(.5f)));
+		}
+		set.build();
+		// everything for every particle, in the ColliderSet order
+		auto naive = [&](Particles& p) {
+			for (int i = 0; i < p.count; i++) {
+				vec3 x = p.position(i), v = p.velocity(i);
+				for (auto& c : set.planes) c.resolveCollision(x, v);
+				for (auto& c : set.spheres) c.resolveCollision(x, v);
+				for (auto& c : set.capsules) c.resolveCollision(x, v);
+				for (auto& c : set.boxes) c.resolveCollision(x, v);
+				p.setPosition(i, x);
+				p.setVelocity(i, v);
+			}
+		};
+		double tNaive = 1e30, tGrid = 1e30;
+		for (int r = 0; r < reps; r++) {
+			Particles a = ps, b = ps;
+			auto t0 = std::chrono::steady_clock::now();
+			naive(a);
+			auto t1 = std::chrono::steady_clock::now();
+			set.resolve(b);
+			auto t2 = std::chrono::steady_clock::now();
+			tNaive = std::min(tNaive, seconds(t0, t1));
+			tGrid = std::min(tGrid, seconds(t1, t2));
+		}
+		Particles a = ps, b = ps;
+		naive(a);
+		set.resolve(b);
+		float maxDx = 0;
+		int moved = 0;
+		for (int i = 0; i < ps.count; i++) {
+			maxDx = std::max(maxDx, length(a.position(i) - b.position(i)));
+			moved += a.position(i) != ps.position(i) || a.velocity(i) != ps.velocity(i);
+		}
+		double naiveTests = (double)ps.count * (nColliders + 1);
+		fprintf(stderr, "%10d %10d %12.0f %10.3f %10d %10.3f %10.2f %10.2g\n", nColliders, moved, naiveTests, tNaive * 1e3,
+			set.tests, tGrid * 1e3, tNaive / tGrid, maxDx);
+		out << "{\"colliders\":" << nColliders << ",\"particles\":" << ps.count << ",\"contacts\":" << moved
+			<< ",\"naive_tests\":" << naiveTests << ",\"naive_s\":" << tNaive << ",\"block_tests\":" << set.tests
+			<< ",\"exact_tests\":" << set.contacts << ",\"grid_s\":" << tGrid << ",\"max_dx\":" << maxDx << "}" << std::endl;
+	}
+
+	{
+		const std::string objFn = "bench_mesh.obj";
+		TriangleMesh sphere = bumpySphere(meshTriangles);
+		FILE* f = fopen(objFn.c_str(), "w");
+		for (auto& v : sphere.vertices) fprintf(f, "v %f %f %f\n", v.x, v.y, v.z);
+		for (auto& t : sphere.faces) fprintf(f, "f %d %d %d\n", t.x + 1, t.y + 1, t.z + 1);
+		fclose(f);
+		TriangleMesh mesh;
+		auto t0 = std::chrono::steady_clock::now();
+		mesh.loadObj(objFn);
+		auto t1 = std::chrono::steady_clock::now();
+		MeshCollider collider;
+		collider.build(mesh);
+		auto t2 = std::chrono::steady_clock::now();
+		remove(objFn.c_str());
+
+		Particles ps = aroundSphere(colliderParticles);
+
+		// the BVH against every triangle on a sample of the particles
+		const int SAMPLE = 200;
+		float maxErr = 0;
+		auto t3 = std::chrono::steady_clock::now();
+		for (int i = 0; i < SAMPLE; i++) {
+			vec3 x = ps.position(i * (ps.count / SAMPLE)), q, N;
+			float best = 1e30f;
+			for (size_t k = 0; k < collider.bvh.corners.size(); k += 3) {
+				int region;
+				vec3 c = TriangleBvh::closestOnTriangle(x, collider.bvh.corners[k], collider.bvh.corners[k + 1],
+					collider.bvh.corners[k + 2], region);
+				best = std::min(best, length(x - c));
+			}
+			int tri;
+			if (collider.bvh.closest(x, 1e30f, q, N, tri)) maxErr = std::max(maxErr, fabsf(length(x - q) - best));
+		}
+		double brute = seconds(t3, std::chrono::steady_clock::now()) / SAMPLE;
+
+		fprintf(stderr, "\nmesh collider, %d triangles (load %.1f ms, bvh %.1f ms, %d nodes), %d particles, brute force %.3f ms per query, max err %.2g\n%8s %10s %10s %10s %10s\n",
+			(int)mesh.faces.size(), seconds(t0, t1) * 1e3, seconds(t1, t2) * 1e3, (int)collider.bvh.nodes.size(), ps.count,
+			brute * 1e3, maxErr, "threads", "contacts", "resolve", "ns/part", "speedup");
+		for (int t : threadCounts) {
+			setParallelThreads(t);
+			double best = 1e30;
+			for (int r = 0; r < reps; r++) {
+				Particles copy = ps;
+				auto a = std::chrono::steady_clock::now();
+				collider.resolve(copy);
+				best = std::min(best, seconds(a, std::chrono::steady_clock::now()));
+			}
+			fprintf(stderr, "%8d %10d %10.3f %10.1f %10.0f\n", t, collider.contacts, best * 1e3, best / ps.count * 1e9,
+				brute * ps.count / best);
+			out << "{\"mesh_triangles\":" << mesh.faces.size() << ",\"threads\":" << t << ",\"particles\":" << ps.count
+				<< ",\"contacts\":" << collider.contacts << ",\"load_s\":" << seconds(t0, t1) << ",\"build_s\":" << seconds(t1, t2)
+				<< ",\"resolve_s\":" << best << ",\"brute_query_s\":" << brute << ",\"max_err\":" << maxErr << "}" << std::endl;
+		}
+		setParallelThreads(0);
+	}
+
+	fprintf(stderr, "\nsdf collider, cell %g, %d particles, ms\n%10s %10s %10s %10s %10s %10s %10s %10s %10s\n", sdfCell, colliderParticles,
+		"triangles", "samples", "bake", "bvh", "bvh ns", "sdf", "sdf ns", "rms_dx", "max_dx");
+	for (int scale : { 100, 10, 1 }) {
+		MeshCollider mesh;
+		mesh.build(bumpySphere(meshTriangles / scale));
+		mesh.depth = 8;		// reaches every particle, like the SDF
+		SdfCollider sdf;
+		auto t0 = std::chrono::steady_clock::now();
+		sdf.bake(mesh.bvh, sdfCell, 2 * mesh.thickness + 1);
+		double bake = seconds(t0, std::chrono::steady_clock::now());
+		sdf.thickness = mesh.thickness;
+		Particles ps = aroundSphere(colliderParticles);
+		const mat3 R(vec3(0, 1, 0), vec3(-1, 0, 0), vec3(0, 0, 1));
+		const vec3 T(10, -5, 3);
+		mesh.setTransform(R, T);
+		sdf.setTransform(R, T);
+		for (int i = 0; i < ps.count; i++) {
+			ps.setPosition(i, R * ps.position(i) + T);
+			ps.setVelocity(i, R * ps.velocity(i));
+		}
+		double tMesh = 1e30, tSdf = 1e30;
+		float maxDx = 0;
+		double sumDx2 = 0;
+		for (int r = 0; r < reps; r++) {
+			Particles a = ps, b = ps;
+			auto t1 = std::chrono::steady_clock::now();
+			mesh.resolve(a);
+			auto t2 = std::chrono::steady_clock::now();
+			sdf.resolve(b);
+			auto t3 = std::chrono::steady_clock::now();
+			tMesh = std::min(tMesh, seconds(t1, t2));
+			tSdf = std::min(tSdf, seconds(t2, t3));
+			for (int i = 0; r == 0 && i < ps.count; i++) {
+				float dx = length(a.position(i) - b.position(i));
+				maxDx = std::max(maxDx, dx);
+				sumDx2 += dx * dx;
+			}
+		}
+		float rmsDx = (float)sqrt(sumDx2 / ps.count);
+		fprintf(stderr, "%10d %10d %10.1f %10.3f %10.1f %10.3f %10.1f %10.3f %10.3f\n", (int)mesh.bvh.normals.size(), (int)sdf.samples.size(),
+			bake * 1e3, tMesh * 1e3, tMesh / ps.count * 1e9, tSdf * 1e3, tSdf / ps.count * 1e9, rmsDx, maxDx);
+		out << "{\"sdf_triangles\":" << mesh.bvh.normals.size() << ",\"cell\":" << sdfCell << ",\"samples\":" << sdf.samples.size()
+			<< ",\"bake_s\":" << bake << ",\"particles\":" << ps.count << ",\"bvh_s\":" << tMesh << ",\"sdf_s\":" << tSdf
+			<< ",\"bvh_contacts\":" << mesh.contacts << ",\"sdf_contacts\":" << sdf.contacts << ",\"rms_dx\":" << rmsDx << ",\"max_dx\":" << maxDx << "}" << std::endl;
+	}
+
+	{
+		const int N = 64, FRAMES = 30;
+		const float top = 10;
+		// a 0.2 thick plate, a sphere of diameter 0.5, a one-sided mesh plate with a thickness of 0.05,
+		// and a smaller 0.2 thick plate baked into an SDF with a padding of 1
+		ColliderSet plate, ball;
+		plate.boxes.push_back(Box(vec3(0), vec3(20, .1f, 20)));
+		plate.build();
+		ball.spheres.push_back(Sphere(vec3(0), .25f));
+		ball.build();
+		TriangleMesh square;
+		square.vertices = { vec3(-20, 0, -20), vec3(20, 0, -20), vec3(20, 0, 20), vec3(-20, 0, 20) };
+		square.faces = { uvec3(0, 2, 1), uvec3(0, 3, 2) };
+		MeshCollider sheet;
+		sheet.thickness = sheet.depth = .05f;
+		sheet.build(square);
+		TriangleMesh slab;
+		for (int i = 0; i < 8; i++) slab.vertices.push_back(vec3(i & 1 ? 2 : -2, i & 2 ? .1f : -.1f, i & 4 ? 2 : -2));
+		slab.faces = { uvec3(0, 4, 6), uvec3(0, 6, 2), uvec3(1, 3, 7), uvec3(1, 7, 5), uvec3(0, 1, 5), uvec3(0, 5, 4),
+			uvec3(2, 6, 7), uvec3(2, 7, 3), uvec3(0, 2, 3), uvec3(0, 3, 1), uvec3(4, 5, 7), uvec3(4, 7, 6) };
+		TriangleBvh slabBvh;
+		slabBvh.build(slab);
+		SdfCollider wall;
+		wall.thickness = .05f;
+		wall.bake(slabBvh, .1f, 1);
+		const float footprint[4] = { 20, .25f / sqrtf(2.f), 20, 2 }, bottom[4] = { -.1f, -.25f, -.05f, -.1f };
+		// percent of the particles that end below the collider and above the footprint, and ms per frame
+		auto tunnel = [&](int kind, int steps, bool ccd, double& ms) {
+			Particles ps;
+			for (int y = 0; y < N; y++) for (int x = 0; x < N; x++) {
+				float f = .9f * footprint[kind];
+				ps.add(MASS, vec3((2.f * x / (N - 1) - 1) * f, top, (2.f * y / (N - 1) - 1) * f), vec3(0, -tunnelSpeed, 0));
+			}
+			const float h = 1 / 60.f / steps;
+			auto sweep = [&](const vec3& x0, const vec3& x1, SweepHit& hit) {
+				if (kind == 0) plate.sweep(x0, x1, hit);
+				else if (kind == 1) ball.sweep(x0, x1, hit);
+				else if (kind == 2) sheet.sweep(x0, x1, hit);
+				else wall.sweep(x0, x1, hit);
+			};
+			auto t0 = std::chrono::steady_clock::now();
+			for (int i = 0; i < FRAMES * steps; i++) {
+				ps.integrate(G, 0, h, [](vec3&, vec3&) {});
+				if (ccd) sweepParticles(ps, h, sweep);
+				if (kind == 0) plate.resolve(ps);
+				else if (kind == 1) ball.resolve(ps);
+				else if (kind == 2) sheet.resolve(ps);
+				else wall.resolve(ps);
+			}
+			ms = seconds(t0, std::chrono::steady_clock::now()) * 1e3 / FRAMES;
+			int through = 0;
+			// straight through: deflected particles leave the footprint
+			for (int i = 0; i < ps.count; i++)
+				through += ps.py[i] < bottom[kind] && fabsf(ps.px[i]) < footprint[kind] && fabsf(ps.pz[i]) < footprint[kind];
+			return 100.f * through / ps.count;
+		};
+		fprintf(stderr, "\ntunneling: %d particles from %g at %g units/s for %d frames, %% through (ms per frame)\n%8s %16s %16s %16s %16s %16s %16s %16s %16s\n",
+			N * N, top, tunnelSpeed, FRAMES, "substeps", "box", "box ccd", "sphere", "sphere ccd", "mesh", "mesh ccd", "sdf", "sdf ccd");
+		for (int steps : { 1, 2, 5, 10, 20, 50, 100 }) {
+			float through[4][2];
+			double ms[4][2];
+			for (int kind = 0; kind < 4; kind++)
+				for (int ccd = 0; ccd < 2; ccd++) through[kind][ccd] = tunnel(kind, steps, ccd, ms[kind][ccd]);
+			fprintf(stderr, "%8d", steps);
+			for (int kind = 0; kind < 4; kind++)
+				for (int ccd = 0; ccd < 2; ccd++) fprintf(stderr, " %7.1f (%6.2f)", through[kind][ccd], ms[kind][ccd]);
+			fprintf(stderr, "\n");
+			const char* names[4] = { "box", "sphere", "mesh", "sdf" };
+			out << "{\"tunnel_substeps\":" << steps << ",\"speed\":" << tunnelSpeed;
+			for (int kind = 0; kind < 4; kind++)
+				out << ",\"" << names[kind] << "\":{\"through_pct\":" << through[kind][0] << ",\"ms_per_frame\":" << ms[kind][0]
+					<< ",\"ccd_through_pct\":" << through[kind][1] << ",\"ccd_ms_per_frame\":" << ms[kind][1] << "}";
+			out << "}" << std::endl;
+		}
+	}
+	return 0;
+}
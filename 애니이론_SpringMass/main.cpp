@@ -8,199 +8,282 @@
 #include <iostream>
 #include <JGL/JGL_Window.hpp>
 #include "AnimView.hpp"
+#include "Headless.hpp"
+#include "Implicit.hpp"
+#include "Xpbd.hpp"
+#include "SelfCollision.hpp"
+#include "Colliders.hpp"
+#include "SdfCollider.hpp"
 #include <glm/gtx/quaternion.hpp>
 
 using namespace glm;
 
-struct Particle {
-	//  ġ ӵ define Particle
-	// newton  2 ̺ ̹Ƿ  · x ٷ ϴ  ( 2 ؾߵǾ)
-	// v ϴ  ٲپ 1 ٲ (a v ) (v -> x  1),  1 2 ϸ  0605 47
-	vec3 x;
-	vec3 v;
-	vec3 f; // accumulate all the force
-	float m;
-	Particle( float mass, const vec3& position, const vec3& velocity=vec3(0) )
-		: x( position ), v( velocity ), m( mass ) {}
-	void clearForce() {
-		f = vec3(0);
-	}
-	void add( const vec3& force ) {
-		f+=force;
-	}
-	void update( float deltaT ) {
-		v += f / m * deltaT;
-		x += v * deltaT;
-	}
-	void draw() {
-		drawSphere( x, 1 );
-	}
-};
-
-struct Spring {
-	Particle& a;
-	Particle& b;
-	float restLength;
-	float k = 4.8f;
-	float kd = 0.0f;
-	Spring( Particle& x, Particle& y ) : a(x), b(y), restLength( length(x.x-y.x)) {
-	}
-	void addForce() {
-		vec3 dx = a.x - b.x;
-		vec3 dx_ = normalize(dx);
-		vec3 dv = a.v - b.v;
-		vec3 f = (k * ( length(dx) - restLength) + kd * dot(dv, dx_)) * dx_;
-		a.add(-f);
-		b.add(f);
-	}
-	void draw() {
-		drawCylinder( a.x, b.x, 0.4, glm::vec4(0,1,.4,1) );
-	}
-};
-
-struct Plane {
-	vec3 N;
-	vec3 p;
-	float alpha = 0.6;
-	Plane( const vec3& position, const vec3& normal ): N(normal), p(position){}
-	void draw() {
-		drawQuad(p,N,{1000,1000},vec4(0,0,1,1));
-	}
-	void resolveCollision( Particle& particle ) {
-		float d = dot(N, particle.x - p);
-		const float eps = 0.0001;
-		if (d < eps) {
-			float v = dot(N, particle.v);
-			if (v < -eps) {
-				vec3 vN = v * N;
-				vec3 vT = particle.v - vN;
-				particle.v = vT - alpha * vN;
-			} else if (v < eps) {
-				vec3 vN = v * N;
-				vec3 vT = particle.v - vN;
-				particle.v = vT;
-			}
-			particle.x += -d * N;
-		}
-	}
-};
-
-struct Sphere {
-	vec3 N;
-	vec3 p;
-	float radius;
-	float alpha = 0.6;
-	Sphere(const vec3& position,const float& r) : p(position), radius(r) {}
-	void draw() {
-		drawSphere(p, radius, vec4(1, 1, 0, alpha));
-	}
-	void resolveCollision(Particle& particle) {
-		N = normalize(particle.x - p);
-		float d = dot(N, particle.x - p) - radius;
-		const float eps = 0.01;
-		if (d < eps) {
-			float v = dot(N, particle.v);
-			if (v < -eps) {
-				vec3 vN = v * N;
-				vec3 vT = particle.v - vN;
-				particle.v = vT - alpha * vN;
-			}
-			else if (v < eps) {
-				vec3 vN = v * N;
-				vec3 vT = particle.v - vN;
-				particle.v = vT;
-			}
-			particle.x += -d * N;
-		}
-	}
-};
-
 float randf() {
 	return rand()/(float)RAND_MAX;
 }
 bool fix0 = true, fix1 = true;
+bool drawCloth = true;		// one shaded mesh instead of particle spheres and spring cylinders
+bool useSelfCollision = true;
+const int selfCollisionInterval = 10;	// substeps between self-collision passes, which cost more than one
+SpringEvaluation springEvaluation = SPRINGS_COLORED;
+// explicit Euler at 10 substeps with continuous collisions (100 without), backward Euler
+// at 2, or XPBD within its iteration budget
+enum Integrator { INTEGRATE_EXPLICIT, INTEGRATE_IMPLICIT, INTEGRATE_XPBD };
+Integrator integrator = INTEGRATE_EXPLICIT;
+ImplicitEuler implicit;
+XpbdSolver xpbd;
+SelfCollision selfCollision;
+MeshCollider meshCollider;		// from --obj, in place of the sphere
+SdfCollider sdfCollider;		// baked from meshCollider on --sdf or 'D'
+bool useSdf = false;
+bool bakingSdf = false;
+bool useCcd = true;				// swept collisions, which let explicit Euler take 10 substeps instead of 100
+
+// Bakes sdfCollider from meshCollider on the loader's workers, and
+// switches to it on the GL thread, between frames, once it is done.
+AsyncLoad bakeSdf() {
+	bakingSdf = true;
+	co_await resumeOnWorker();
+	SdfCollider baked;
+	baked.bake( meshCollider.bvh, 1.f, 2.f, AsyncLoader::workerFor );
+	co_await resumeOnGL();
+	baked.setTransform( meshCollider.rotation, meshCollider.translation );
+	baked.velocity = meshCollider.velocity;
+	baked.angularVelocity = meshCollider.angularVelocity;
+	sdfCollider = std::move( baked );
+	bakingSdf = false;
+	useSdf = true;
+	std::cout<<"mesh collisions: sdf"<<std::endl;
+}
 
 void keyFunc(int key) {
 	if( key == '1' )
 		fix0=!fix0;
 	if( key == '2' )
 		fix1=!fix1;
+	if( key == 'M' )
+		drawCloth=!drawCloth;
+	if( key == 'K' ) {
+		useSelfCollision=!useSelfCollision;
+		std::cout<<"self-collision: "<<( useSelfCollision ? "on" : "off" )<<std::endl;
+	}
+	if( key == 'P' ) {
+		const char* names[] = { "serial", "colored", "gathered" };
+		springEvaluation = SpringEvaluation( ( springEvaluation+1 )%3 );
+		std::cout<<"spring forces: "<<names[springEvaluation]<<std::endl;
+	}
+	if( key == 'I' ) {
+		const char* names[] = { "explicit", "implicit", "xpbd" };
+		integrator = Integrator( ( integrator+1 )%3 );
+		std::cout<<"integrator: "<<names[integrator]<<std::endl;
+	}
+	if( key == 'J' ) {
+		xpbd.jacobi=!xpbd.jacobi;
+		std::cout<<"xpbd: "<<( xpbd.jacobi ? "jacobi" : "colored gauss-seidel" )<<std::endl;
+	}
+	if( key == '[' || key == ']' ) {
+		// same budget, fewer or more substeps
+		xpbd.substeps = std::clamp( key == ']' ? xpbd.substeps*2 : xpbd.substeps/2, 1, xpbd.budget );
+		std::cout<<"xpbd: "<<xpbd.substeps<<" substeps x "<<xpbd.iterationsPerSubstep()<<" iterations"<<std::endl;
+	}
+	if( key == 'D' && !meshCollider.bvh.empty() && !bakingSdf ) {
+		if( sdfCollider.empty() ) {
+			std::cout<<"mesh collisions: baking the sdf"<<std::endl;
+			bakeSdf();
+		}
+		else {
+			useSdf=!useSdf;
+			std::cout<<"mesh collisions: "<<( useSdf ? "sdf" : "bvh" )<<std::endl;
+		}
+	}
+	if( key == 'T' ) {
+		useCcd=!useCcd;
+		std::cout<<"continuous collisions: "<<( useCcd ? "on" : "off" )<<std::endl;
+	}
+	if( key == 'S' && integrator == INTEGRATE_XPBD ) {
+		const XpbdStats& s = xpbd.stats;
+		std::cout<<"xpbd: "<<s.substeps<<" substeps, "<<s.iterations<<" iterations, strain max "<<s.maxStrain
+			<<" rms "<<s.rmsStrain<<", "<<s.milliseconds<<" ms"<<std::endl;
+	}
 }
 
 const vec3 G ( 0, -980.f, 0 );
 const float k_drag = 0.01f;
-std::vector<Particle> particles;
-std::vector<Spring> springs;
-Plane flooring( {0,0,0}, {0,1,0} );
-Sphere sphere({0,30,-5}, 30.f);
+Particles particles;
+Springs springs;
+ColliderSet colliders;
 const int count = 20;
+DynamicMesh clothMesh;
+int simulated = 0, meshed = -1;	// states of the particles simulated, and uploaded into clothMesh
+int pin0, pin1;		// the top corners, held in place by fix0/fix1
 
 void init() {
 	particles.clear();
+	springs.clear();
 	float randomness = 0.0;
 	for (int y = 0; y < count; ++y) {
 		for (int x = 0; x < count; ++x) {
-			particles.emplace_back(0.001, vec3(x * 40.f/count - 18.f + randf() * randomness, 
+			particles.add(0.001, vec3(x * 40.f/count - 18.f + randf() * randomness, 
 				y * 40.f/count + 70 + randf() * randomness, randf() * 0.001));
 		}
 	}
-	/*for (auto& p : particles)
-		p.x = rotate(quat(sqrt(3) / 2, 0, 0, 0.5), p.x - vec3(10, 40, 0)) + vec3(10, 40, 0);*/
+	std::vector<uvec3> faces;
+	for (int y = 0; y < count - 1; ++y) {
+		for (int x = 0; x < count - 1; ++x) {
+			unsigned int i = y * count + x;
+			faces.push_back({ i, i + 1, i + count });
+			faces.push_back({ i + 1, i + count + 1, i + count });
+		}
+	}
+	/*for (int i = 0; i < particles.count; i++)
+		particles.setPosition(i, rotate(quat(sqrt(3) / 2, 0, 0, 0.5), particles.position(i) - vec3(10, 40, 0)) + vec3(10, 40, 0));*/
 	for (int y = 0; y < count - 1; ++y) {
 		for (int x = 0; x < count; ++x) {
-			springs.emplace_back(particles[y * count + x], particles[(y + 1) * count + x]);
+			springs.add(particles, y * count + x, (y + 1) * count + x);
 		}
 	}
 	for (int y = 0; y < count; ++y) {
 		for (int x = 0; x < count - 1; ++x) {
-			springs.emplace_back(particles[y * count + x], particles[y * count + x + 1] );
+			springs.add(particles, y * count + x, y * count + x + 1);
 		}
 	}
 	for (int y = 0; y < count - 1; ++y) {
 		for (int x = 0; x < count - 1; ++x) {
-			springs.emplace_back(particles[y * count + x], particles[(y + 1) * count + x + 1]);
+			springs.add(particles, y * count + x, (y + 1) * count + x + 1);
 		}
 	}
 	for (int y = 0; y < count - 1; ++y) {
 		for (int x = 0; x < count - 1; ++x) {
-			springs.emplace_back(particles[(y+1) * count + x], particles[y * count + x + 1]);
+			springs.add(particles, (y+1) * count + x, y * count + x + 1);
 		}
 	}
 	//springs.clear();
+	std::vector<int> newIndex = reorderMorton(particles, springs);
+	springs.buildColors(particles.count);
+	for (auto& f : faces)
+		f = uvec3(newIndex[f.x], newIndex[f.y], newIndex[f.z]);
+	clothMesh.setFaces(faces, count * count);
+	pin0 = newIndex[(count - 1) * count];
+	pin1 = newIndex[count * count - 1];
+	implicit.reset();
+	colliders.clear();
+	colliders.planes.push_back(Plane({0,0,0}, {0,1,0}));
+	if (meshCollider.bvh.empty())
+		colliders.spheres.push_back(Sphere({0,30,-5}, 30.f));
+	colliders.build();
+	simulated++;
 }
 void frame( float dt ) {
-	const int steps = 100;
+	// XPBD substeps inside its own frame()
+	const int steps = integrator == INTEGRATE_XPBD ? 1 : integrator == INTEGRATE_IMPLICIT ? 2 : useCcd ? 10 : 100;
+	const float h = integrator == INTEGRATE_XPBD ? dt / std::max(1, xpbd.substeps) : dt / steps;
+	auto sweep = [](const vec3& x0, const vec3& x1, SweepHit& hit) {
+		colliders.sweep(x0, x1, hit);
+		if (useSdf) sdfCollider.sweep(x0, x1, hit);
+		else meshCollider.sweep(x0, x1, hit);
+	};
+	auto collide = [&](vec3& x, vec3& v) {
+		if (useCcd) {
+			// the path of the substep, which ended at x with velocity v
+			SweepHit hit;
+			vec3 x0 = x - h * v;
+			sweep(x0, x, hit);
+			hit.apply(x0, x, v);
+		}
+		colliders.resolveCollision(x, v);
+		if (useSdf) sdfCollider.resolveCollision(x, v);
+		else meshCollider.resolveCollision(x, v);
+	};
+	std::vector<int> fixed;
+	if (fix0) fixed.push_back(pin0);
+	if (fix1) fixed.push_back(pin1);
 
 	for( int i = 0; i < steps; i++ ) {
-		vec3 p0 = particles[(count - 1) * count].x;
-		vec3 p1 = particles[(count) * count - 1].x;
-		for (auto& p : particles) p.clearForce();
-		for (auto& s : springs) s.addForce();
-		for (auto& p : particles) p.add(p.m * G); // Gravity
-		for (auto& p : particles) p.add(-k_drag * p.v); // Viscous drag
-		for (auto& p : particles) p.update(dt / steps);
-		for (auto& p : particles) flooring.resolveCollision(p);
-		for (auto& p : particles) sphere.resolveCollision(p);
+		vec3 p0 = particles.position(pin0);
+		vec3 p1 = particles.position(pin1);
+		if (integrator == INTEGRATE_XPBD)
+			xpbd.frame(particles, springs, G, k_drag, dt, fixed, collide);
+		else if (integrator == INTEGRATE_IMPLICIT)
+			implicit.step(particles, springs, springEvaluation, G, k_drag, h, fixed, collide);
+		else {
+			springs.addForces(particles, springEvaluation);
+			// gravity, viscous drag and update in one sweep, then collisions by blocks
+			particles.integrate(G, k_drag, h, [](vec3&, vec3&) {});
+			if (useCcd)
+				sweepParticles(particles, h, sweep);
+			colliders.resolve(particles);
+			if (useSdf) sdfCollider.resolve(particles);
+			else meshCollider.resolve(particles);
+		}
+		// at the end of the frame in any case
+		if (useSelfCollision && ((i + 1) % selfCollisionInterval == 0 || i == steps - 1))
+			selfCollision.resolve(particles, springs);
 		if (fix0) {
-			particles[(count - 1) * count].x = p0;
-			particles[(count - 1) * count].v = vec3(0, 0, 0);
+			particles.setPosition(pin0, p0);
+			particles.setVelocity(pin0, vec3(0, 0, 0));
 		}
 		if (fix1) {
-			particles[count * count - 1].x = p1;
-			particles[count * count - 1].v = vec3(0, 0, 0); 
+			particles.setPosition(pin1, p1);
+			particles.setVelocity(pin1, vec3(0, 0, 0));
 		}
 	}
-	
+	simulated++;
 }
 
 void render() {
-	for( auto& p : particles ) p.draw();
-	for( auto& s : springs )   s.draw();
-	flooring.draw();
-	sphere.draw();
+	if( drawCloth ) {
+		// render() runs once per pass unless the draw list is recorded
+		if( meshed != simulated ) {
+			clothMesh.update( particles.px.data(), particles.py.data(), particles.pz.data() );
+			meshed = simulated;
+		}
+		drawMesh( clothMesh, vec4(0,1,.4,1) );
+	}
+	else {
+		for( int i=0; i<particles.count; i++ ) drawSphere( particles.position(i), 1 );
+		springs.draw( particles );
+	}
+	meshCollider.draw();
+	beginStatic();
+	colliders.draw();
+	endStatic();
+}
+
+// Scales and moves a mesh to 60 units high, on the floor below the cloth,
+// where the sphere would be.
+void loadCollider(const char* fn) {
+	TriangleMesh mesh;
+	if (!mesh.loadObj(fn) || mesh.vertices.empty()) return;
+	vec3 lo = mesh.vertices[0], hi = lo;
+	for (auto& v : mesh.vertices) {
+		lo = min(lo, v);
+		hi = max(hi, v);
+	}
+	float scale = 60.f / std::max(hi.y - lo.y, 1e-6f);
+	vec3 base = vec3((lo.x + hi.x) / 2, lo.y, (lo.z + hi.z) / 2);
+	for (auto& v : mesh.vertices)
+		v = (v - base) * scale + vec3(0, 0, -5);
+	meshCollider.build(mesh);
 }
 
 int main(int argc, const char * argv[]) {
+	for (int i = 1; i + 1 < argc; i++)
+		if (std::string(argv[i]) == "--obj")
+			loadCollider(argv[i + 1]);
+	for (int i = 1; i < argc; i++)
+		if (std::string(argv[i]) == "--sdf")
+			keyFunc('D');
+	HeadlessOptions headless;
+	if( headless.parse( argc, argv ) ) {
+		AnimView* animView = new AnimView(0,0,headless.width,headless.height);
+		animView->renderFunction = render;
+		animView->frameFunction = frame;
+		animView->initFunction = init;
+		init();
+		int result = runHeadless( *animView, headless );
+		delete animView;
+		return result;
+	}
 	JGL::Window* window = new JGL::Window(800,600,"simulation");
 	window->alignment(JGL::ALIGN_ALL);
 	AnimView* animView = new AnimView(0,0,800,600);